@@ -38,19 +38,78 @@
 #include <QtDBus/QDBusMessage>
 
 #include "calendardataserviceadaptor.h"
+#include "../common/sharedsegment.h"
 #include "../../src/calendaragendamodel.h"
-#include "../../src/calendarevent.h"
-#include "../../src/calendareventoccurrence.h"
 #include "../../src/calendarmanager.h"
+#include "../../src/calendarutils.h"
+
+// Number of ranges served at the same time, each one by its own agenda model.
+static const int MaxAgendaModelCount = 4;
+
+// Filter values, as in CalendarEventsModel.
+enum FilterMode {
+    FilterNone,
+    FilterPast,
+    FilterPastAndCurrent
+};
+
+enum ContentType {
+    ContentAllDay,
+    ContentEvents,
+    ContentAll
+};
+
+// Serialized size from which compact results are passed in a shared
+// segment to clients which asked for it.
+static const int SharedSegmentThreshold = 64 * 1024;
+
+// How long a computed reply is given to identical requests, which tend
+// to come from several clients at once, if the data doesn't change.
+static const int ReplyCacheTimeout = 2000;
+
+// Internal request refreshing the snapshot.
+static const QString SnapshotTransactionId = QStringLiteral("snapshot");
 
 CalendarDataService::CalendarDataService(QObject *parent) :
-    QObject(parent), mAgendaModel(0), mTransactionIdCounter(0)
+    QObject(parent), mPersistent(false), mSnapshotPending(false), mSnapshotUpdated(false),
+    mReplyCacheHits(0), mTransactionIdCounter(0)
 {
+    mColdLatency.count = 0;
+    mColdLatency.total = 0;
+    mWarmLatency = mColdLatency;
+    mSnapshotLatency = mColdLatency;
+    mSnapshot.open();
+
     mKillTimer.setSingleShot(true);
     mKillTimer.setInterval(2000);
     connect(&mKillTimer, SIGNAL(timeout()), this, SLOT(shutdown()));
     mKillTimer.start();
 
+    // Subscriptions end with their client.
+    mClientWatcher.setConnection(QDBusConnection::sessionBus());
+    mClientWatcher.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(&mClientWatcher, SIGNAL(serviceUnregistered(QString)), this, SLOT(clientVanished(QString)));
+
+    // Changes of all the models refreshed together are sent at once.
+    mDataChangedTimer.setSingleShot(true);
+    mDataChangedTimer.setInterval(0);
+    connect(&mDataChangedTimer, SIGNAL(timeout()), this, SLOT(emitDataChanged()));
+
+    mReplyCacheTimer.setSingleShot(true);
+    mReplyCacheTimer.setInterval(ReplyCacheTimeout);
+    connect(&mReplyCacheTimer, SIGNAL(timeout()), this, SLOT(expireReplies()));
+
+    mExpiryTimer.setSingleShot(true);
+    mExpiryTimer.setTimerType(Qt::PreciseTimer);
+    connect(&mExpiryTimer, SIGNAL(timeout()), this, SLOT(subscriptionsExpired()));
+
+    // Drop the cache, or exit, when the system runs low on memory.
+    QDBusConnection::systemBus().connect(QStringLiteral("com.nokia.mce"),
+                                         QStringLiteral("/com/nokia/mce/signal"),
+                                         QStringLiteral("com.nokia.mce.signal"),
+                                         QStringLiteral("sig_memory_level_ind"),
+                                         this, SLOT(memoryLevelChanged(QString)));
+
     registerCalendarDataServiceTypes();
     new CalendarDataServiceAdaptor(this);
     QDBusConnection connection = QDBusConnection::sessionBus();
@@ -64,7 +123,38 @@ CalendarDataService::CalendarDataService(QObject *parent) :
         QCoreApplication::exit(1);
 }
 
+void CalendarDataService::setIdleTimeout(int msecs)
+{
+    mKillTimer.setInterval(msecs);
+    if (mKillTimer.isActive())
+        mKillTimer.start();
+}
+
+void CalendarDataService::setPersistent(bool persistent)
+{
+    mPersistent = persistent;
+    if (mPersistent)
+        mKillTimer.stop();
+    else if (!hasPendingRequests())
+        mKillTimer.start();
+}
+
 QString CalendarDataService::getEvents(const QString &startDate, const QString &endDate)
+{
+    return addRequest(startDate, endDate, ReplyList);
+}
+
+QString CalendarDataService::getEventsV2(const QString &startDate, const QString &endDate)
+{
+    return addRequest(startDate, endDate, ReplyCompact);
+}
+
+QString CalendarDataService::getEventsShared(const QString &startDate, const QString &endDate)
+{
+    return addRequest(startDate, endDate, ReplyShared);
+}
+
+QString CalendarDataService::addRequest(const QString &startDate, const QString &endDate, ReplyFormat format)
 {
     mKillTimer.stop();
     QDate start = QDate::fromString(startDate, Qt::ISODate);
@@ -77,91 +167,793 @@ QString CalendarDataService::getEvents(const QString &startDate, const QString &
                 .arg(QCoreApplication::applicationPid())
                 .arg(++mTransactionIdCounter);
         DataRequest dataRequest = { start, end, transactionId };
-        mDataRequestQueue.insert(0, dataRequest);
+        mDataRequestQueue.append(dataRequest);
+        mRequestTimers[transactionId].start();
+        if (format != ReplyList)
+            mReplyFormats.insert(transactionId, format);
+        if (!mSnapshot.isCurrent())
+            updateSnapshot();
     }
     // Delay triggering until after return to ensure that client gets transactionId
     QTimer::singleShot(1, this, SLOT(processQueue()));
     return transactionId;
 }
 
-void CalendarDataService::updated()
+QString CalendarDataService::subscribe(const QString &startDate, const QString &endDate,
+                                      const QVariantMap &filter, const QString &client)
+{
+    Subscription subscription;
+    subscription.start = QDate::fromString(startDate, Qt::ISODate);
+    subscription.end = QDate::fromString(endDate, Qt::ISODate);
+    if (!subscription.start.isValid() || !subscription.end.isValid()) {
+        qWarning() << "Invalid date parameter(s):" << startDate << ", " << endDate;
+        return QString();
+    }
+    subscription.client = client;
+    subscription.contentType = filter.value(QStringLiteral("contentType"), ContentAll).toInt();
+    subscription.filterMode = filter.value(QStringLiteral("filterMode"), FilterNone).toInt();
+    subscription.eventDisplayTime = filter.value(QStringLiteral("eventDisplayTime"), 0).toInt();
+    subscription.limit = filter.value(QStringLiteral("limit"), 0).toInt();
+    subscription.shared = filter.value(QStringLiteral("sharedMemory"), false).toBool();
+    subscription.sequence = 0;
+    subscription.reset = true;
+    subscription.totalCount = 0;
+    subscription.expiryTime = 0;
+
+    mKillTimer.stop();
+    QString subscriptionId = QString("%1-s%2")
+            .arg(QCoreApplication::applicationPid())
+            .arg(++mTransactionIdCounter);
+    mSubscriptions.insert(subscriptionId, subscription);
+    if (!client.isEmpty())
+        mClientWatcher.addWatchedService(client);
+
+    // The first update holds all the events of the range.
+    DataRequest dataRequest = { subscription.start, subscription.end, subscriptionId };
+    mDataRequestQueue.append(dataRequest);
+    QTimer::singleShot(1, this, SLOT(processQueue()));
+    return subscriptionId;
+}
+
+void CalendarDataService::unsubscribe(const QString &subscriptionId)
+{
+    if (!mSubscriptions.contains(subscriptionId))
+        return;
+
+    const QString client = mSubscriptions.take(subscriptionId).client;
+    cancelRequest(subscriptionId);
+
+    bool clientSubscribed = false;
+    foreach (const Subscription &subscription, mSubscriptions)
+        clientSubscribed |= (subscription.client == client);
+    if (!clientSubscribed)
+        mClientWatcher.removeWatchedService(client);
+
+    if (!hasPendingRequests())
+        startIdleTimer();
+}
+
+void CalendarDataService::resync(const QString &subscriptionId)
+{
+    QHash<QString, Subscription>::iterator it = mSubscriptions.find(subscriptionId);
+    if (it == mSubscriptions.end())
+        return;
+
+    it->reset = true;
+    DataRequest dataRequest = { it->start, it->end, subscriptionId };
+    mDataRequestQueue.append(dataRequest);
+    QTimer::singleShot(1, this, SLOT(processQueue()));
+}
+
+void CalendarDataService::clientVanished(const QString &client)
+{
+    foreach (const QString &subscriptionId, mSubscriptions.keys()) {
+        if (mSubscriptions.value(subscriptionId).client == client)
+            unsubscribe(subscriptionId);
+    }
+    mClientWatcher.removeWatchedService(client);
+}
+
+// Drops a request which hasn't been answered yet.
+void CalendarDataService::cancelRequest(const QString &transactionId)
+{
+    for (int i = mDataRequestQueue.count() - 1; i >= 0; --i) {
+        if (mDataRequestQueue.at(i).transactionId == transactionId)
+            mDataRequestQueue.removeAt(i);
+    }
+    for (int i = 0; i < mAgendaSlots.count(); ++i)
+        mAgendaSlots[i].transactionIds.removeAll(transactionId);
+    mColdTransactions.remove(transactionId);
+    mRequestTimers.remove(transactionId);
+}
+
+QVariantMap CalendarDataService::getStatistics()
 {
-    EventDataList reply;
-    for (int i = 0; i < mAgendaModel->count(); i++) {
-        QVariant variant = mAgendaModel->get(i, CalendarAgendaModel::EventObjectRole);
-        QVariant occurrenceVariant = mAgendaModel->get(i, CalendarAgendaModel::OccurrenceObjectRole);
-        if (variant.canConvert<CalendarEvent *>() && occurrenceVariant.canConvert<CalendarEventOccurrence *>()) {
-            CalendarEvent* event = variant.value<CalendarEvent *>();
-            CalendarEventOccurrence* occurrence = occurrenceVariant.value<CalendarEventOccurrence *>();
+    // Don't start the manager only to report that it has no data.
+    CalendarManager *manager = CalendarManager::instance(false);
+    QVariantMap statistics = manager ? manager->statistics() : QVariantMap();
+
+    // Latencies of getEvents() until its result, in ms.
+    statistics.insert(QStringLiteral("coldRequests"), mColdLatency.count);
+    statistics.insert(QStringLiteral("coldLatencyAverage"),
+                      mColdLatency.count ? mColdLatency.total / mColdLatency.count : 0);
+    statistics.insert(QStringLiteral("warmRequests"), mWarmLatency.count);
+    statistics.insert(QStringLiteral("warmLatencyAverage"),
+                      mWarmLatency.count ? mWarmLatency.total / mWarmLatency.count : 0);
+    statistics.insert(QStringLiteral("snapshotRequests"), mSnapshotLatency.count);
+    statistics.insert(QStringLiteral("snapshotLatencyAverage"),
+                      mSnapshotLatency.count ? mSnapshotLatency.total / mSnapshotLatency.count : 0);
+    // Requests answered with a reply computed for an identical one.
+    statistics.insert(QStringLiteral("replyCacheHits"), mReplyCacheHits);
+    statistics.insert(QStringLiteral("persistent"), mPersistent);
+    statistics.insert(QStringLiteral("subscriptions"), mSubscriptions.count());
+    return statistics;
+}
+
+// Reads the contents of an agenda model in one pass over the manager's
+// data, without going through the model's QObjects and QVariants.
+static void readAgendaModel(CalendarAgendaModel *model, EventDataList *eventDataList,
+                            CompactEventDataList *compactEventDataList)
+{
+    CalendarManager *manager = CalendarManager::instance();
+    const QList<CalendarManager::AgendaItem> agenda = manager->agenda(model->startDate(), model->endDate());
+    QHash<QString, QString> colors;
+
+    foreach (const CalendarManager::AgendaItem &item, agenda) {
+        const CalendarData::EventOccurrence &occurrence = *item.first;
+        const CalendarData::Event &event = *item.second;
+        QHash<QString, QString>::iterator color = colors.find(event.calendarUid);
+        if (color == colors.end())
+            color = colors.insert(event.calendarUid, manager->getNotebookColor(event.calendarUid));
+        const QString recurrenceId = event.recurrenceId.isValid()
+                ? CalendarUtils::recurrenceIdToString(event.recurrenceId) : QString();
+
+        if (eventDataList) {
             EventData eventStruct;
-            eventStruct.displayLabel = event->displayLabel();
-            eventStruct.description = event->description();
-            if (event->allDay()) {
-                eventStruct.startTime = occurrence->startTime().date().toString(Qt::ISODate);
-                eventStruct.endTime = occurrence->endTime().date().toString(Qt::ISODate);
+            eventStruct.displayLabel = event.displayLabel;
+            eventStruct.description = event.description;
+            if (event.allDay) {
+                eventStruct.startTime = occurrence.startTime.date().toString(Qt::ISODate);
+                eventStruct.endTime = occurrence.endTime.date().toString(Qt::ISODate);
             } else {
-                eventStruct.startTime = occurrence->startTime().toString(Qt::ISODate);
-                eventStruct.endTime = occurrence->endTime().toString(Qt::ISODate);
+                eventStruct.startTime = occurrence.startTime.toString(Qt::ISODate);
+                eventStruct.endTime = occurrence.endTime.toString(Qt::ISODate);
             }
-            eventStruct.allDay = event->allDay();
-            eventStruct.color = event->color();
-            eventStruct.recurrenceId = event->recurrenceIdString();
-            eventStruct.uniqueId = event->uniqueId();
-            reply << eventStruct;
-        }
-    }
-    if (!mCurrentDataRequest.transactionId.isEmpty()
-            && mCurrentDataRequest.start == mAgendaModel->startDate()
-            && mCurrentDataRequest.end == mAgendaModel->endDate()) {
-        emit getEventsResult(mCurrentDataRequest.transactionId, reply);
-        mCurrentDataRequest = DataRequest();
+            eventStruct.allDay = event.allDay;
+            eventStruct.color = color.value();
+            eventStruct.recurrenceId = recurrenceId;
+            eventStruct.uniqueId = event.uniqueId;
+            eventStruct.calendarUid = event.calendarUid;
+            eventStruct.location = event.location;
+            *eventDataList << eventStruct;
+        }
+        if (compactEventDataList) {
+            CompactEventData eventStruct;
+            eventStruct.displayLabel = event.displayLabel;
+            eventStruct.description = event.description;
+            if (event.allDay) {
+                eventStruct.startTime = QDateTime(occurrence.startTime.date(), QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+                eventStruct.endTime = QDateTime(occurrence.endTime.date(), QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+            } else {
+                eventStruct.startTime = occurrence.startTime.toMSecsSinceEpoch();
+                eventStruct.endTime = occurrence.endTime.toMSecsSinceEpoch();
+            }
+            eventStruct.allDay = event.allDay;
+            eventStruct.notebook = compactEventDataList->notebookIndex(event.calendarUid, color.value());
+            eventStruct.recurrenceId = recurrenceId;
+            eventStruct.uniqueId = event.uniqueId;
+            eventStruct.location = event.location;
+            compactEventDataList->events << eventStruct;
+        }
+    }
+}
+
+// Only used for the snapshot contents, which are stored in the
+// string based format.
+static CompactEventDataList toCompactEventDataList(const EventDataList &eventDataList)
+{
+    CompactEventDataList compactEventDataList;
+    foreach (const EventData &e, eventDataList) {
+        CompactEventData eventStruct;
+        eventStruct.displayLabel = e.displayLabel;
+        eventStruct.description = e.description;
+        if (e.allDay) {
+            eventStruct.startTime = QDateTime(QDate::fromString(e.startTime, Qt::ISODate), QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+            eventStruct.endTime = QDateTime(QDate::fromString(e.endTime, Qt::ISODate), QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+        } else {
+            eventStruct.startTime = QDateTime::fromString(e.startTime, Qt::ISODate).toMSecsSinceEpoch();
+            eventStruct.endTime = QDateTime::fromString(e.endTime, Qt::ISODate).toMSecsSinceEpoch();
+        }
+        eventStruct.allDay = e.allDay;
+        eventStruct.notebook = compactEventDataList.notebookIndex(e.calendarUid, e.color);
+        eventStruct.recurrenceId = e.recurrenceId;
+        eventStruct.uniqueId = e.uniqueId;
+        eventStruct.location = e.location;
+        compactEventDataList.events << eventStruct;
+    }
+    return compactEventDataList;
+}
+
+void CalendarDataService::sendResults(AgendaSlot *slot)
+{
+    const QDate start = slot->model->startDate();
+    const QDate end = slot->model->endDate();
+
+    // Identical requests share the same result.
+    foreach (const QString &transactionId, slot->transactionIds) {
+        if (transactionId == SnapshotTransactionId) {
+            mColdTransactions.remove(transactionId);
+            mSnapshot.write(start, end, reply(start, end, ReplyList, slot).eventDataList,
+                            slot->databaseKey);
+            mSnapshotPending = false;
+            mSnapshotUpdated = true;
+            continue;
+        }
+        if (mSubscriptions.contains(transactionId)) {
+            mColdTransactions.remove(transactionId);
+            sendSubscriptionUpdate(transactionId, slot->contents);
+            continue;
+        }
+        const ReplyFormat format = mReplyFormats.take(transactionId);
+        sendReply(transactionId, format, reply(start, end, format, slot));
+
+        LatencyStatistics &latency = mColdTransactions.remove(transactionId) ? mColdLatency : mWarmLatency;
+        latency.count++;
+        latency.total += mRequestTimers.take(transactionId).elapsed();
+    }
+    slot->transactionIds.clear();
+}
+
+static bool canShareSegments()
+{
+    return QDBusConnection::sessionBus().connectionCapabilities() & QDBusConnection::UnixFileDescriptorPassing;
+}
+
+static QString replyKey(const QDate &start, const QDate &end, int format)
+{
+    return QString("%1/%2/%3").arg(start.toString(Qt::ISODate)).arg(end.toString(Qt::ISODate)).arg(format);
+}
+
+// Returns the reply for the range, from the slot showing it, or from the
+// snapshot without one. It is computed once, and reused until it expires.
+const CalendarDataService::CachedReply &CalendarDataService::reply(const QDate &start, const QDate &end,
+                                                                  ReplyFormat format, const AgendaSlot *slot)
+{
+    const QString key = replyKey(start, end, format);
+    QHash<QString, CachedReply>::const_iterator it = mReplyCache.constFind(key);
+    if (it != mReplyCache.constEnd() && it->age.elapsed() < ReplyCacheTimeout) {
+        mReplyCacheHits++;
+        return *it;
+    }
+
+    CachedReply cachedReply;
+    if (format == ReplyList) {
+        if (slot)
+            readAgendaModel(slot->model, &cachedReply.eventDataList, 0);
+        else
+            cachedReply.eventDataList = mSnapshot.events(start, end);
     } else {
-        qWarning() << "No transactionId, discarding results";
+        cachedReply.compactEventDataList = slot
+                ? slot->contents
+                : toCompactEventDataList(reply(start, end, ReplyList, 0).eventDataList);
+        // Large results go in a shared segment to the clients which accept it.
+        // All of them get the same one, it is sealed.
+        if (format == ReplyShared && canShareSegments()) {
+            QByteArray data;
+            QDataStream stream(&data, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_5_6);
+            stream << cachedReply.compactEventDataList;
+            if (data.size() >= SharedSegmentThreshold)
+                cachedReply.segment = SharedSegment::create(data);
+        }
+    }
+    cachedReply.age.start();
+    if (!mReplyCacheTimer.isActive())
+        mReplyCacheTimer.start();
+    return *mReplyCache.insert(key, cachedReply);
+}
+
+void CalendarDataService::sendReply(const QString &transactionId, ReplyFormat format, const CachedReply &reply)
+{
+    if (format == ReplyList)
+        emit getEventsResult(transactionId, reply.eventDataList);
+    else if (reply.segment.isValid())
+        emit getEventsResultShared(transactionId, reply.segment);
+    else
+        emit getEventsResultV2(transactionId, reply.compactEventDataList);
+}
+
+void CalendarDataService::invalidateReplies(const QDate &start, const QDate &end)
+{
+    mReplyCache.remove(replyKey(start, end, ReplyList));
+    mReplyCache.remove(replyKey(start, end, ReplyCompact));
+    mReplyCache.remove(replyKey(start, end, ReplyShared));
+}
+
+void CalendarDataService::storageModified()
+{
+    // The ranges without a model wouldn't get invalidated otherwise.
+    mReplyCache.clear();
+
+    // The models get refreshed from this state on.
+    const QByteArray databaseKey = CalendarSnapshot::databaseKey();
+    for (int i = 0; i < mAgendaSlots.count(); ++i)
+        mAgendaSlots[i].databaseKey = databaseKey;
+}
+
+void CalendarDataService::expireReplies()
+{
+    QHash<QString, CachedReply>::iterator it = mReplyCache.begin();
+    while (it != mReplyCache.end()) {
+        if (it->age.elapsed() >= ReplyCacheTimeout)
+            it = mReplyCache.erase(it);
+        else
+            ++it;
+    }
+    if (!mReplyCache.isEmpty())
+        mReplyCacheTimer.start();
+}
+
+static bool sameEvent(const CompactEventData &e1, const CompactEventData &e2)
+{
+    return e1.uniqueId == e2.uniqueId
+            && e1.recurrenceId == e2.recurrenceId
+            && e1.startTime == e2.startTime
+            && e1.endTime == e2.endTime
+            && e1.allDay == e2.allDay
+            && e1.displayLabel == e2.displayLabel
+            && e1.description == e2.description
+            && e1.location == e2.location;
+}
+
+// Sends the difference between the events of the subscription and the
+// ones it was last sent, or all of them after a (re)subscription.
+// Returns the events matching the filter of the subscription, up to its
+// limit, with the number of all the matching ones and the time when the
+// time based filtering will change the result, or 0.
+CompactEventDataList CalendarDataService::filterEvents(const Subscription &subscription,
+                                                       const CompactEventDataList &eventDataList,
+                                                       int *totalCount, qint64 *expiryTime)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    CompactEventDataList result;
+    *totalCount = 0;
+    *expiryTime = 0;
+
+    foreach (const CompactEventData &e, eventDataList.events) {
+        if ((e.allDay && subscription.contentType == ContentEvents)
+                || (!e.allDay && subscription.contentType == ContentAllDay)) {
+            continue;
+        }
+
+        qint64 startTime;
+        qint64 endTime;
+        if (e.allDay) {
+            // Shown from the local midnight starting the day, and over on the
+            // one following the (inclusive) end date.
+            startTime = QDateTime(QDateTime::fromMSecsSinceEpoch(e.startTime, Qt::UTC).date()).toMSecsSinceEpoch();
+            endTime = QDateTime(QDateTime::fromMSecsSinceEpoch(e.endTime, Qt::UTC).date().addDays(1)).toMSecsSinceEpoch();
+        } else {
+            startTime = e.startTime;
+            endTime = subscription.eventDisplayTime > 0
+                    ? e.startTime + subscription.eventDisplayTime * qint64(1000)
+                    : e.endTime;
+        }
+
+        qint64 changeTime = 0;
+        if (subscription.filterMode == FilterPast) {
+            if (now >= endTime)
+                continue;
+            changeTime = endTime;
+        } else if (subscription.filterMode == FilterPastAndCurrent) {
+            if (now >= startTime)
+                continue;
+            changeTime = startTime;
+        }
+
+        if (subscription.limit <= 0 || result.events.count() < subscription.limit) {
+            const CompactNotebookData notebook = eventDataList.notebooks.value(e.notebook);
+            CompactEventData data = e;
+            data.notebook = result.notebookIndex(notebook.uid, notebook.color);
+            result.events << data;
+            if (changeTime && (!*expiryTime || changeTime < *expiryTime))
+                *expiryTime = changeTime;
+        }
+        ++*totalCount;
+    }
+    return result;
+}
+
+void CalendarDataService::sendSubscriptionUpdate(const QString &subscriptionId,
+                                                 const CompactEventDataList &eventDataList)
+{
+    Subscription &subscription = mSubscriptions[subscriptionId];
+    int totalCount;
+    qint64 expiryTime;
+    const CompactEventDataList filtered = filterEvents(subscription, eventDataList, &totalCount, &expiryTime);
+
+    QHash<QString, SubscribedEvent> events;
+    CompactEventDataList added;
+    CompactEventDataList changed;
+    QStringList removed;
+
+    foreach (const CompactEventData &e, filtered.events) {
+        SubscribedEvent event;
+        event.data = e;
+        event.notebook = filtered.notebooks.value(e.notebook);
+        const QString key = e.key();
+        events.insert(key, event);
+
+        QHash<QString, SubscribedEvent>::const_iterator previous = subscription.events.constFind(key);
+        CompactEventDataList *list = 0;
+        if (subscription.reset || previous == subscription.events.constEnd()) {
+            list = &added;
+        } else if (!sameEvent(previous->data, e)
+                   || previous->notebook.uid != event.notebook.uid
+                   || previous->notebook.color != event.notebook.color) {
+            list = &changed;
+        }
+        if (list) {
+            CompactEventData data = e;
+            data.notebook = list->notebookIndex(event.notebook.uid, event.notebook.color);
+            list->events << data;
+        }
+    }
+    if (!subscription.reset) {
+        QHash<QString, SubscribedEvent>::const_iterator it;
+        for (it = subscription.events.constBegin(); it != subscription.events.constEnd(); ++it) {
+            if (!events.contains(it.key()))
+                removed << it.key();
+        }
+    }
+
+    const bool countsChanged = subscription.totalCount != totalCount || subscription.expiryTime != expiryTime;
+    subscription.events = events;
+    subscription.totalCount = totalCount;
+    subscription.expiryTime = expiryTime;
+    scheduleExpiry();
+    if (!subscription.reset && !countsChanged
+            && added.events.isEmpty() && changed.events.isEmpty() && removed.isEmpty())
+        return;
+
+    bool reset = subscription.reset;
+    subscription.reset = false;
+    ++subscription.sequence;
+    if (subscription.shared && canShareSegments()) {
+        QByteArray data;
+        QDataStream stream(&data, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_6);
+        stream << reset << added << changed << removed << qint32(totalCount) << expiryTime;
+        if (data.size() >= SharedSegmentThreshold) {
+            QDBusUnixFileDescriptor segment = SharedSegment::create(data);
+            if (segment.isValid()) {
+                emit eventsChangedShared(subscriptionId, subscription.sequence, segment);
+                return;
+            }
+        }
+    }
+    emit eventsChanged(subscriptionId, subscription.sequence, reset, added, changed, removed,
+                       totalCount, expiryTime);
+}
+
+// Wakes up for the first subscription whose filtered events change by time.
+void CalendarDataService::scheduleExpiry()
+{
+    qint64 expiryTime = 0;
+    foreach (const Subscription &subscription, mSubscriptions) {
+        if (subscription.expiryTime && (!expiryTime || subscription.expiryTime < expiryTime))
+            expiryTime = subscription.expiryTime;
+    }
+
+    if (!expiryTime) {
+        mExpiryTimer.stop();
+    } else {
+        // Long waits are split, timers take an int.
+        qint64 delay = expiryTime - QDateTime::currentMSecsSinceEpoch();
+        mExpiryTimer.start(int(qBound(qint64(0), delay, qint64(24 * 60 * 60 * 1000))));
+    }
+}
+
+void CalendarDataService::subscriptionsExpired()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    foreach (const QString &subscriptionId, mSubscriptions.keys()) {
+        const Subscription &subscription = mSubscriptions[subscriptionId];
+        if (!subscription.expiryTime || subscription.expiryTime > now)
+            continue;
+        int index = findSlot(subscription.start, subscription.end);
+        if (index >= 0 && mAgendaSlots.at(index).ready)
+            sendSubscriptionUpdate(subscriptionId, mAgendaSlots.at(index).contents);
+    }
+    scheduleExpiry();
+}
+
+static QDate eventDate(const CompactEventData &e, qint64 time)
+{
+    return QDateTime::fromMSecsSinceEpoch(time, e.allDay ? Qt::UTC : Qt::LocalTime).date();
+}
+
+static bool sameNotebook(const CompactEventDataList &list1, const CompactEventData &e1,
+                         const CompactEventDataList &list2, const CompactEventData &e2)
+{
+    const CompactNotebookData notebook1 = list1.notebooks.value(e1.notebook);
+    const CompactNotebookData notebook2 = list2.notebooks.value(e2.notebook);
+    return notebook1.uid == notebook2.uid && notebook1.color == notebook2.color;
+}
+
+// Returns the dates covered by the occurrences which were added, removed
+// or modified, or an invalid range when there are none.
+static QPair<QDate, QDate> changedDates(const CompactEventDataList &oldContents,
+                                        const CompactEventDataList &newContents)
+{
+    QPair<QDate, QDate> range;
+    QHash<QString, int> oldEvents;
+    for (int i = 0; i < oldContents.events.count(); ++i)
+        oldEvents.insert(oldContents.events.at(i).key(), i);
+
+    QList<CompactEventData> changed;
+    foreach (const CompactEventData &e, newContents.events) {
+        QHash<QString, int>::iterator it = oldEvents.find(e.key());
+        if (it == oldEvents.end()) {
+            changed << e;
+        } else {
+            const CompactEventData &old = oldContents.events.at(it.value());
+            if (!sameEvent(old, e) || !sameNotebook(oldContents, old, newContents, e))
+                changed << old << e;
+            oldEvents.erase(it);
+        }
+    }
+    // Left ones were removed.
+    foreach (int index, oldEvents)
+        changed << oldContents.events.at(index);
+
+    foreach (const CompactEventData &e, changed) {
+        QDate start = eventDate(e, e.startTime);
+        QDate end = qMax(start, eventDate(e, e.endTime));
+        if (!range.first.isValid() || start < range.first)
+            range.first = start;
+        if (!range.second.isValid() || end > range.second)
+            range.second = end;
+    }
+    return range;
+}
+
+void CalendarDataService::updated()
+{
+    CalendarAgendaModel *model = qobject_cast<CalendarAgendaModel *>(sender());
+    for (int i = 0; i < mAgendaSlots.count(); ++i) {
+        AgendaSlot &slot = mAgendaSlots[i];
+        if (slot.model == model) {
+            invalidateReplies(model->startDate(), model->endDate());
+
+            // The contents are kept for compact replies, and to tell
+            // clients which dates changed when the model got refreshed.
+            CompactEventDataList contents;
+            readAgendaModel(model, 0, &contents);
+            if (slot.ready) {
+                QPair<QDate, QDate> range = changedDates(slot.contents, contents);
+                if (range.first.isValid()) {
+                    mChangedRanges.append(range);
+                    mDataChangedTimer.start();
+                }
+            }
+            slot.contents = contents;
+            slot.ready = true;
+
+            // Subscribers get the changes, if any.
+            QHash<QString, Subscription>::const_iterator it;
+            for (it = mSubscriptions.constBegin(); it != mSubscriptions.constEnd(); ++it) {
+                if (it->start == model->startDate() && it->end == model->endDate()
+                        && !slot.transactionIds.contains(it.key()))
+                    slot.transactionIds.append(it.key());
+            }
+            sendResults(&slot);
+            break;
+        }
     }
     processQueue();
 }
 
+void CalendarDataService::emitDataChanged()
+{
+    qSort(mChangedRanges.begin(), mChangedRanges.end());
+
+    QStringList ranges;
+    QPair<QDate, QDate> range = mChangedRanges.value(0);
+    for (int i = 1; i <= mChangedRanges.count(); ++i) {
+        if (i < mChangedRanges.count() && mChangedRanges.at(i).first <= range.second.addDays(1)) {
+            range.second = qMax(range.second, mChangedRanges.at(i).second);
+        } else {
+            ranges << range.first.toString(Qt::ISODate) + QLatin1Char('/') + range.second.toString(Qt::ISODate);
+            if (i < mChangedRanges.count())
+                range = mChangedRanges.at(i);
+        }
+    }
+    mChangedRanges.clear();
+
+    if (!ranges.isEmpty())
+        emit dataChanged(ranges);
+}
+
+// Answers a request which would need a load from the snapshot, if it is
+// up to date, and refreshes the snapshot in the background once.
+bool CalendarDataService::sendSnapshotResults(const DataRequest &request)
+{
+    if (request.transactionId == SnapshotTransactionId
+            || mSubscriptions.contains(request.transactionId)
+            || !mSnapshot.covers(request.start, request.end) || !mSnapshot.isCurrent())
+        return false;
+
+    const ReplyFormat format = mReplyFormats.take(request.transactionId);
+    sendReply(request.transactionId, format, reply(request.start, request.end, format, 0));
+    mSnapshotLatency.count++;
+    mSnapshotLatency.total += mRequestTimers.take(request.transactionId).elapsed();
+
+    if (!mSnapshotUpdated)
+        updateSnapshot();
+    return true;
+}
+
+void CalendarDataService::updateSnapshot()
+{
+    if (mSnapshotPending)
+        return;
+
+    mSnapshotPending = true;
+    DataRequest dataRequest = { CalendarSnapshot::windowStart(), CalendarSnapshot::windowEnd(),
+                                SnapshotTransactionId };
+    mDataRequestQueue.append(dataRequest);
+}
+
 void CalendarDataService::shutdown()
 {
     QDBusConnection connection = QDBusConnection::sessionBus();
     connection.unregisterService("org.nemomobile.calendardataservice");
     connection.unregisterObject("/org/nemomobile/calendardataservice");
 
-    if (mAgendaModel) {
+    unloadCache();
+    QTimer::singleShot(0, QCoreApplication::instance(), SLOT(quit()));
+}
+
+void CalendarDataService::unloadCache()
+{
+    if (!mAgendaSlots.isEmpty()) {
         // Call CalendarManager dtor to ensure that the QThread managed by it
         // will be destroyed via deleteLater when control returns to the event loop.
-        // Delete the AgendaModel first, its destructor refers to CalendarManager
-        delete mAgendaModel;
+        // Delete the AgendaModels first, their destructor refers to CalendarManager
+        foreach (const AgendaSlot &slot, mAgendaSlots)
+            delete slot.model;
+        mAgendaSlots.clear();
+        mReplyCache.clear();
         delete CalendarManager::instance();
     }
-    QTimer::singleShot(0, QCoreApplication::instance(), SLOT(quit()));
 }
 
-void CalendarDataService::initialize()
+void CalendarDataService::memoryLevelChanged(const QString &level)
 {
-    if (!mAgendaModel) {
-        mAgendaModel = new CalendarAgendaModel(this);
-        connect(mAgendaModel, SIGNAL(updated()), this, SLOT(updated()));
+    if (level == QLatin1String("normal") || hasPendingRequests())
+        return;
+
+    if (!mPersistent && mSubscriptions.isEmpty()) {
+        mKillTimer.stop();
+        shutdown();
+        return;
     }
+
+    // The next request will load its range again. Subscribed ranges are
+    // loaded again right away, with only the ranges still followed.
+    // Their subscribers get the changes against what they were last sent.
+    unloadCache();
+    QHash<QString, Subscription>::const_iterator it;
+    for (it = mSubscriptions.constBegin(); it != mSubscriptions.constEnd(); ++it) {
+        DataRequest dataRequest = { it->start, it->end, it.key() };
+        mDataRequestQueue.append(dataRequest);
+    }
+    if (!mDataRequestQueue.isEmpty())
+        QTimer::singleShot(1, this, SLOT(processQueue()));
 }
 
-void CalendarDataService::processQueue()
+bool CalendarDataService::hasPendingRequests() const
 {
-    if (mDataRequestQueue.isEmpty()) {
+    if (!mDataRequestQueue.isEmpty())
+        return true;
+
+    foreach (const AgendaSlot &slot, mAgendaSlots) {
+        if (!slot.transactionIds.isEmpty())
+            return true;
+    }
+    return false;
+}
+
+void CalendarDataService::startIdleTimer()
+{
+    if (!mPersistent && mSubscriptions.isEmpty())
         mKillTimer.start();
-        return;
+}
+
+bool CalendarDataService::isSubscribed(const AgendaSlot &slot) const
+{
+    foreach (const Subscription &subscription, mSubscriptions) {
+        if (subscription.start == slot.model->startDate() && subscription.end == slot.model->endDate())
+            return true;
     }
+    return false;
+}
 
-    if (mCurrentDataRequest.transactionId.isEmpty()) {
-        initialize();
-        mCurrentDataRequest = mDataRequestQueue.takeLast();
-        if (mAgendaModel->startDate() == mCurrentDataRequest.start
-                && mAgendaModel->endDate() == mCurrentDataRequest.end) {
-            // We already have the events, go to updated() directly
-            updated();
-        } else {
-            mAgendaModel->setStartDate(mCurrentDataRequest.start);
-            mAgendaModel->setEndDate(mCurrentDataRequest.end);
+int CalendarDataService::findSlot(const QDate &start, const QDate &end) const
+{
+    for (int i = 0; i < mAgendaSlots.count(); ++i) {
+        const CalendarAgendaModel *model = mAgendaSlots.at(i).model;
+        if (model->startDate() == start && model->endDate() == end)
+            return i;
+    }
+    return -1;
+}
+
+// Returns a new slot, or the least recently used one without pending
+// transactions, or -1 when all of them are busy. Subscribed slots are
+// kept, and not counted against the maximum.
+int CalendarDataService::availableSlot()
+{
+    int subscribedCount = 0;
+    foreach (const AgendaSlot &slot, mAgendaSlots) {
+        if (isSubscribed(slot))
+            subscribedCount++;
+    }
+
+    if (mAgendaSlots.count() - subscribedCount < MaxAgendaModelCount) {
+        AgendaSlot slot;
+        slot.model = new CalendarAgendaModel(this);
+        slot.ready = false;
+        connect(slot.model, SIGNAL(updated()), this, SLOT(updated()));
+        connect(CalendarManager::instance(), SIGNAL(storageModified()),
+                this, SLOT(storageModified()), Qt::UniqueConnection);
+        mAgendaSlots.append(slot);
+        return mAgendaSlots.count() - 1;
+    }
+
+    for (int i = 0; i < mAgendaSlots.count(); ++i) {
+        if (mAgendaSlots.at(i).transactionIds.isEmpty() && !isSubscribed(mAgendaSlots.at(i)))
+            return i;
+    }
+    return -1;
+}
+
+void CalendarDataService::processQueue()
+{
+    // Requests may get added while going through the queue.
+    QList<DataRequest> waitingRequests;
+    while (!mDataRequestQueue.isEmpty()) {
+        const DataRequest request = mDataRequestQueue.takeFirst();
+        int index = findSlot(request.start, request.end);
+        if ((index < 0 || !mAgendaSlots.at(index).ready) && sendSnapshotResults(request))
+            continue;
+
+        if (index < 0) {
+            index = availableSlot();
+            if (index < 0) {
+                waitingRequests.append(request);
+                continue;
+            }
+            mAgendaSlots[index].ready = false;
+            mAgendaSlots[index].databaseKey = CalendarSnapshot::databaseKey();
+            mAgendaSlots[index].model->setStartDate(request.start);
+            mAgendaSlots[index].model->setEndDate(request.end);
         }
+        if (!mAgendaSlots.at(index).ready)
+            mColdTransactions.insert(request.transactionId);
+        mAgendaSlots[index].transactionIds.append(request.transactionId);
+        mAgendaSlots.append(mAgendaSlots.takeAt(index));
     }
+    mDataRequestQueue = waitingRequests;
+
+    // Ranges already loaded are answered right away, the other
+    // ones when their model gets updated.
+    for (int i = 0; i < mAgendaSlots.count(); ++i) {
+        if (mAgendaSlots.at(i).ready)
+            sendResults(&mAgendaSlots[i]);
+    }
+
+    if (!hasPendingRequests())
+        startIdleTimer();
 }
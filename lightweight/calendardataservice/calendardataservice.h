@@ -36,8 +36,16 @@
 #include <QtCore/QObject>
 #include <QtCore/QDate>
 #include <QtCore/QTimer>
+#include <QtCore/QVariantMap>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtDBus/QDBusServiceWatcher>
+#include <QtDBus/QDBusUnixFileDescriptor>
 
 #include "../common/eventdata.h"
+#include "calendarsnapshot.h"
 
 class CalendarAgendaModel;
 
@@ -48,33 +56,169 @@ class CalendarDataService : public QObject
 public:
     explicit CalendarDataService(QObject *parent = 0);
 
+    // Time without requests after which the service exits.
+    void setIdleTimeout(int msecs);
+    // When persistent, the service never exits on its own, and keeps
+    // its agenda models updated on storage changes until memory gets low.
+    // The service also stays while any client is subscribed. Low memory
+    // then drops the cache, and only the subscribed ranges get loaded again.
+    void setPersistent(bool persistent);
+
     void fetchEvents();
 
 signals:
     void getEventsResult(const QString &transactionId, const EventDataList &eventDataList);
+    void getEventsResultV2(const QString &transactionId, const CompactEventDataList &eventDataList);
+    // Changes since the previous update of the subscription. With reset, added
+    // holds all the events and the previous ones are to be dropped. totalCount
+    // is the number of matching events before the limit, and expiryTime when
+    // the time based filter changes the result next, in ms since the epoch,
+    // or 0.
+    void eventsChanged(const QString &subscriptionId, uint sequence, bool reset,
+                       const CompactEventDataList &added, const CompactEventDataList &changed,
+                       const QStringList &removed, int totalCount, qint64 expiryTime);
+    // Date ranges, as "start/end" ISO dates, in which events were added,
+    // removed or modified. Only the loaded ranges are followed.
+    void dataChanged(const QStringList &ranges);
+    // Same as getEventsResultV2 and eventsChanged, with their arguments
+    // serialized with QDataStream in a SharedSegment.
+    void getEventsResultShared(const QString &transactionId, const QDBusUnixFileDescriptor &segment);
+    void eventsChangedShared(const QString &subscriptionId, uint sequence, const QDBusUnixFileDescriptor &segment);
 
 public slots:
     QString getEvents(const QString &startDate, const QString &endDate);
+    QString getEventsV2(const QString &startDate, const QString &endDate);
+    // Replies with getEventsResultShared when the result is large.
+    QString getEventsShared(const QString &startDate, const QString &endDate);
+    QVariantMap getStatistics();
+    // The filter takes "contentType", "filterMode", "eventDisplayTime" and
+    // "limit", as the CalendarEventsModel properties of the same name, and
+    // "sharedMemory" for eventsChangedShared on large updates.
+    QString subscribe(const QString &startDate, const QString &endDate, const QVariantMap &filter,
+                      const QString &client);
+    void unsubscribe(const QString &subscriptionId);
+    void resync(const QString &subscriptionId);
 
 private slots:
     void updated();
+    void storageModified();
+    void expireReplies();
+    void clientVanished(const QString &client);
+    void emitDataChanged();
+    void subscriptionsExpired();
     void shutdown();
     void processQueue();
+    void memoryLevelChanged(const QString &level);
 
 private:
+    enum ReplyFormat {
+        ReplyList,      // getEventsResult
+        ReplyCompact,   // getEventsResultV2
+        ReplyShared     // getEventsResultShared, or getEventsResultV2 when small
+    };
+
+    // A result computed for a range, given to the identical requests
+    // which follow until it expires, or the range gets refreshed.
+    struct CachedReply {
+        EventDataList eventDataList;
+        CompactEventDataList compactEventDataList;
+        // Set for large shared replies only.
+        QDBusUnixFileDescriptor segment;
+        QElapsedTimer age;
+    };
+
     struct DataRequest {
         QDate start;
         QDate end;
         QString transactionId;
     };
 
-    void initialize();
+    // An agenda model showing one range, and the transactions
+    // waiting for its contents.
+    struct AgendaSlot {
+        CalendarAgendaModel *model;
+        bool ready;
+        QStringList transactionIds;
+        // Model contents as of its last update.
+        CompactEventDataList contents;
+        // Database state before the contents were last asked for.
+        QByteArray databaseKey;
+    };
+
+    // Range kept up to date for a client, and the events it was last sent.
+    struct SubscribedEvent {
+        CompactEventData data;
+        CompactNotebookData notebook;
+    };
+    struct Subscription {
+        QDate start;
+        QDate end;
+        QString client;
+        int contentType;
+        int filterMode;
+        int eventDisplayTime; // seconds
+        int limit;
+        bool shared;
+        uint sequence;
+        bool reset;
+        QHash<QString, SubscribedEvent> events;
+        int totalCount;
+        qint64 expiryTime;
+    };
+
+    QString addRequest(const QString &startDate, const QString &endDate, ReplyFormat format);
+    bool isSubscribed(const AgendaSlot &slot) const;
+    static CompactEventDataList filterEvents(const Subscription &subscription,
+                                             const CompactEventDataList &eventDataList,
+                                             int *totalCount, qint64 *expiryTime);
+    void sendSubscriptionUpdate(const QString &subscriptionId, const CompactEventDataList &eventDataList);
+    void scheduleExpiry();
+    void cancelRequest(const QString &transactionId);
+    int findSlot(const QDate &start, const QDate &end) const;
+    int availableSlot();
+    void sendResults(AgendaSlot *slot);
+    const CachedReply &reply(const QDate &start, const QDate &end, ReplyFormat format,
+                             const AgendaSlot *slot);
+    void sendReply(const QString &transactionId, ReplyFormat format, const CachedReply &reply);
+    void invalidateReplies(const QDate &start, const QDate &end);
+    bool sendSnapshotResults(const DataRequest &request);
+    void updateSnapshot();
+    bool hasPendingRequests() const;
+    void startIdleTimer();
+    void unloadCache();
+
+    struct LatencyStatistics {
+        int count;
+        qint64 total;
+    };
 
-    CalendarAgendaModel *mAgendaModel;
     QTimer mKillTimer;
+    bool mPersistent;
+    // Requests served from a model which had to be loaded first, by
+    // transaction id, and when all requests were received.
+    QSet<QString> mColdTransactions;
+    QHash<QString, QElapsedTimer> mRequestTimers;
+    // Requests not answered with getEventsResult, by transaction id.
+    QHash<QString, ReplyFormat> mReplyFormats;
+    // By range and format.
+    QHash<QString, CachedReply> mReplyCache;
+    QTimer mReplyCacheTimer;
+    int mReplyCacheHits;
+    LatencyStatistics mColdLatency;
+    LatencyStatistics mWarmLatency;
+    LatencyStatistics mSnapshotLatency;
+    CalendarSnapshot mSnapshot;
+    bool mSnapshotPending;
+    bool mSnapshotUpdated;
     int mTransactionIdCounter;
     QList<DataRequest> mDataRequestQueue;
-    DataRequest mCurrentDataRequest;
+    // Least recently used first.
+    QList<AgendaSlot> mAgendaSlots;
+    QHash<QString, Subscription> mSubscriptions;
+    QDBusServiceWatcher mClientWatcher;
+    QList<QPair<QDate, QDate> > mChangedRanges;
+    QTimer mDataChangedTimer;
+    QTimer mExpiryTimer;
 };
 
 #endif // CALENDARDATASERVICE_H
@@ -2,7 +2,7 @@ TEMPLATE = app
 TARGET = calendardataservice
 target.path = /usr/bin
 
-QT += qml dbus
+QT += qml dbus concurrent
 QT -= gui
 
 CONFIG += link_pkgconfig
@@ -11,30 +11,38 @@ PKGCONFIG += KF5CalendarCore libmkcal-qt5 accounts-qt5
 HEADERS += \
     calendardataservice.h \
     calendardataserviceadaptor.h \
+    calendarsnapshot.h \
     ../common/eventdata.h \
+    ../common/sharedsegment.h \
     ../../src/calendaragendamodel.h \
     ../../src/calendarmanager.h \
     ../../src/calendarworker.h \
+    ../../src/calendarreader.h \
     ../../src/calendareventoccurrence.h \
     ../../src/calendarevent.h \
     ../../src/calendarchangeinformation.h \
     ../../src/calendareventquery.h \
     ../../src/calendarinvitationquery.h \
-    ../../src/calendarutils.h
+    ../../src/calendarutils.h \
+    ../../src/calendartrace.h
 
 SOURCES += \
     calendardataservice.cpp \
     calendardataserviceadaptor.cpp \
+    calendarsnapshot.cpp \
     ../common/eventdata.cpp \
+    ../common/sharedsegment.cpp \
     ../../src/calendaragendamodel.cpp \
     ../../src/calendarmanager.cpp \
     ../../src/calendarworker.cpp \
+    ../../src/calendarreader.cpp \
     ../../src/calendareventoccurrence.cpp \
     ../../src/calendarevent.cpp \
     ../../src/calendarchangeinformation.cpp \
     ../../src/calendareventquery.cpp \
     ../../src/calendarinvitationquery.cpp \
     ../../src/calendarutils.cpp \
+    ../../src/calendartrace.cpp \
     main.cpp
 
 dbus_service.path = /usr/share/dbus-1/services/
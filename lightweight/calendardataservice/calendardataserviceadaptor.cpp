@@ -58,3 +58,63 @@ QString CalendarDataServiceAdaptor::getEvents(const QString &startDate, const QS
                               Q_ARG(QString, endDate));
     return transactionId;
 }
+
+QString CalendarDataServiceAdaptor::getEventsV2(const QString &startDate, const QString &endDate)
+{
+    // handle method call org.nemomobile.calendardataservice.getEventsV2
+    QString transactionId;
+    QMetaObject::invokeMethod(parent(), "getEventsV2",
+                              Q_RETURN_ARG(QString, transactionId),
+                              Q_ARG(QString, startDate),
+                              Q_ARG(QString, endDate));
+    return transactionId;
+}
+
+QString CalendarDataServiceAdaptor::getEventsShared(const QString &startDate, const QString &endDate)
+{
+    // handle method call org.nemomobile.calendardataservice.getEventsShared
+    QString transactionId;
+    QMetaObject::invokeMethod(parent(), "getEventsShared",
+                              Q_RETURN_ARG(QString, transactionId),
+                              Q_ARG(QString, startDate),
+                              Q_ARG(QString, endDate));
+    return transactionId;
+}
+
+QVariantMap CalendarDataServiceAdaptor::getStatistics()
+{
+    // handle method call org.nemomobile.calendardataservice.getStatistics
+    QVariantMap statistics;
+    QMetaObject::invokeMethod(parent(), "getStatistics",
+                              Q_RETURN_ARG(QVariantMap, statistics));
+    return statistics;
+}
+
+QString CalendarDataServiceAdaptor::subscribe(const QString &startDate, const QString &endDate,
+                                             const QVariantMap &filter)
+{
+    // handle method call org.nemomobile.calendardataservice.subscribe
+    // The caller is watched to end its subscriptions when it goes away.
+    QString subscriptionId;
+    QMetaObject::invokeMethod(parent(), "subscribe",
+                              Q_RETURN_ARG(QString, subscriptionId),
+                              Q_ARG(QString, startDate),
+                              Q_ARG(QString, endDate),
+                              Q_ARG(QVariantMap, filter),
+                              Q_ARG(QString, calledFromDBus() ? message().service() : QString()));
+    return subscriptionId;
+}
+
+void CalendarDataServiceAdaptor::unsubscribe(const QString &subscriptionId)
+{
+    // handle method call org.nemomobile.calendardataservice.unsubscribe
+    QMetaObject::invokeMethod(parent(), "unsubscribe",
+                              Q_ARG(QString, subscriptionId));
+}
+
+void CalendarDataServiceAdaptor::resync(const QString &subscriptionId)
+{
+    // handle method call org.nemomobile.calendardataservice.resync
+    QMetaObject::invokeMethod(parent(), "resync",
+                              Q_ARG(QString, subscriptionId));
+}
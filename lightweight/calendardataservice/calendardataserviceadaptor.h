@@ -41,7 +41,7 @@
 /*
  * Adaptor class for interface org.nemomobile.calendardataservice
  */
-class CalendarDataServiceAdaptor: public QDBusAbstractAdaptor
+class CalendarDataServiceAdaptor: public QDBusAbstractAdaptor, protected QDBusContext
 {
     Q_OBJECT
     Q_CLASSINFO("D-Bus Interface", "org.nemomobile.calendardataservice")
@@ -52,10 +52,61 @@ class CalendarDataServiceAdaptor: public QDBusAbstractAdaptor
                 "      <arg direction=\"in\" type=\"s\" name=\"endDate\"/>\n"
                 "      <arg direction=\"out\" type=\"s\" name=\"transactionId\"/>\n"
                 "    </method>\n"
+                "    <method name=\"getEventsV2\">\n"
+                "      <arg direction=\"in\" type=\"s\" name=\"startDate\"/>\n"
+                "      <arg direction=\"in\" type=\"s\" name=\"endDate\"/>\n"
+                "      <arg direction=\"out\" type=\"s\" name=\"transactionId\"/>\n"
+                "    </method>\n"
+                "    <method name=\"getStatistics\">\n"
+                "      <arg direction=\"out\" type=\"a{sv}\" name=\"statistics\"/>\n"
+                "    </method>\n"
+                "    <method name=\"getEventsShared\">\n"
+                "      <arg direction=\"in\" type=\"s\" name=\"startDate\"/>\n"
+                "      <arg direction=\"in\" type=\"s\" name=\"endDate\"/>\n"
+                "      <arg direction=\"out\" type=\"s\" name=\"transactionId\"/>\n"
+                "    </method>\n"
+                "    <method name=\"subscribe\">\n"
+                "      <arg direction=\"in\" type=\"s\" name=\"startDate\"/>\n"
+                "      <arg direction=\"in\" type=\"s\" name=\"endDate\"/>\n"
+                "      <arg direction=\"in\" type=\"a{sv}\" name=\"filter\"/>\n"
+                "      <arg direction=\"out\" type=\"s\" name=\"subscriptionId\"/>\n"
+                "    </method>\n"
+                "    <method name=\"unsubscribe\">\n"
+                "      <arg direction=\"in\" type=\"s\" name=\"subscriptionId\"/>\n"
+                "    </method>\n"
+                "    <method name=\"resync\">\n"
+                "      <arg direction=\"in\" type=\"s\" name=\"subscriptionId\"/>\n"
+                "    </method>\n"
                 "    <signal name=\"getEventsResult\">\n"
                 "      <arg type=\"s\" name=\"transactionId\"/>\n"
                 "      <arg type=\"a(sssssbssss)\" name=\"eventDataList\"/>\n"
                 "    </signal>\n"
+                "    <signal name=\"getEventsResultV2\">\n"
+                "      <arg type=\"s\" name=\"transactionId\"/>\n"
+                "      <arg type=\"(a(ss)a(ssxxbisss))\" name=\"eventDataList\"/>\n"
+                "    </signal>\n"
+                "    <signal name=\"eventsChanged\">\n"
+                "      <arg type=\"s\" name=\"subscriptionId\"/>\n"
+                "      <arg type=\"u\" name=\"sequence\"/>\n"
+                "      <arg type=\"b\" name=\"reset\"/>\n"
+                "      <arg type=\"(a(ss)a(ssxxbisss))\" name=\"added\"/>\n"
+                "      <arg type=\"(a(ss)a(ssxxbisss))\" name=\"changed\"/>\n"
+                "      <arg type=\"as\" name=\"removed\"/>\n"
+                "      <arg type=\"i\" name=\"totalCount\"/>\n"
+                "      <arg type=\"x\" name=\"expiryTime\"/>\n"
+                "    </signal>\n"
+                "    <signal name=\"dataChanged\">\n"
+                "      <arg type=\"as\" name=\"ranges\"/>\n"
+                "    </signal>\n"
+                "    <signal name=\"getEventsResultShared\">\n"
+                "      <arg type=\"s\" name=\"transactionId\"/>\n"
+                "      <arg type=\"h\" name=\"segment\"/>\n"
+                "    </signal>\n"
+                "    <signal name=\"eventsChangedShared\">\n"
+                "      <arg type=\"s\" name=\"subscriptionId\"/>\n"
+                "      <arg type=\"u\" name=\"sequence\"/>\n"
+                "      <arg type=\"h\" name=\"segment\"/>\n"
+                "    </signal>\n"
                 "  </interface>\n"
                 "")
 
@@ -65,9 +116,22 @@ public:
 
 public Q_SLOTS:
     QString getEvents(const QString &startDate, const QString &endDate);
+    QString getEventsV2(const QString &startDate, const QString &endDate);
+    QString getEventsShared(const QString &startDate, const QString &endDate);
+    QVariantMap getStatistics();
+    QString subscribe(const QString &startDate, const QString &endDate, const QVariantMap &filter);
+    void unsubscribe(const QString &subscriptionId);
+    void resync(const QString &subscriptionId);
 
 Q_SIGNALS:
     void getEventsResult(const QString &transactionId, const EventDataList &eventDataList);
+    void getEventsResultV2(const QString &transactionId, const CompactEventDataList &eventDataList);
+    void eventsChanged(const QString &subscriptionId, uint sequence, bool reset,
+                       const CompactEventDataList &added, const CompactEventDataList &changed,
+                       const QStringList &removed, int totalCount, qint64 expiryTime);
+    void dataChanged(const QStringList &ranges);
+    void getEventsResultShared(const QString &transactionId, const QDBusUnixFileDescriptor &segment);
+    void eventsChangedShared(const QString &subscriptionId, uint sequence, const QDBusUnixFileDescriptor &segment);
 };
 
 #endif
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "calendarsnapshot.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QTimeZone>
+
+namespace {
+
+const char SnapshotMagic[4] = { 'N', 'C', 'S', 'N' };
+// To be increased whenever the layout of the header or the records changes.
+const quint32 SnapshotVersion = 1;
+
+// The first and the last day where an occurrence shows in the agenda,
+// following the rules of CalendarManager::updateAgendaModel().
+void occurrenceDays(const EventData &event, QDate *first, QDate *last)
+{
+    if (event.allDay) {
+        *first = QDate::fromString(event.startTime, Qt::ISODate);
+        *last = QDate::fromString(event.endTime, Qt::ISODate);
+    } else {
+        const QDateTime start = QDateTime::fromString(event.startTime, Qt::ISODate);
+        const QDateTime end = QDateTime::fromString(event.endTime, Qt::ISODate);
+        *first = start.date();
+        *last = end.time() > QTime(0, 0) ? end.date() : end.date().addDays(-1);
+    }
+}
+
+}
+
+// Stored as is, the snapshot is only meant to be read on the device
+// which wrote it.
+struct CalendarSnapshot::Header {
+    char magic[4];
+    quint32 version;
+    char key[16];       // databaseKey() when written
+    char checksum[16];  // MD5 of the records
+    qint64 windowStart; // julian days, inclusive
+    qint64 windowEnd;
+    quint32 count;
+    quint32 size;       // of the records
+};
+
+CalendarSnapshot::CalendarSnapshot()
+    : mData(0)
+{
+}
+
+CalendarSnapshot::~CalendarSnapshot()
+{
+    close();
+}
+
+QDate CalendarSnapshot::windowStart()
+{
+    return QDate::currentDate().addDays(-7);
+}
+
+QDate CalendarSnapshot::windowEnd()
+{
+    return QDate::currentDate().addDays(60);
+}
+
+QString CalendarSnapshot::fileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + QLatin1String("/agenda.snapshot");
+}
+
+// Changes whenever the database files, or the time zone in which
+// the occurrences were expanded, change.
+QByteArray CalendarSnapshot::databaseKey()
+{
+    QString database = QString::fromLocal8Bit(qgetenv("SQLITESTORAGEDB"));
+    if (database.isEmpty())
+        database = QDir::homePath() + QLatin1String("/.local/share/system/privileged/Calendar/mkcal/db");
+
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    const QStringList files = QStringList() << database
+                                            << database + QLatin1String("-wal")
+                                            << database + QLatin1String("-journal");
+    foreach (const QString &file, files) {
+        const QFileInfo info(file);
+        hash.addData(QByteArray::number(info.exists() ? info.size() : -1));
+        hash.addData(QByteArray::number(info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1));
+    }
+    hash.addData(QTimeZone::systemTimeZoneId());
+    return hash.result();
+}
+
+const CalendarSnapshot::Header *CalendarSnapshot::header() const
+{
+    return reinterpret_cast<const Header *>(mData);
+}
+
+bool CalendarSnapshot::open()
+{
+    close();
+
+    mFile.setFileName(fileName());
+    if (!mFile.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = mFile.size();
+    if (size >= qint64(sizeof(Header)))
+        mData = mFile.map(0, size);
+    if (!mData) {
+        close();
+        return false;
+    }
+
+    const Header *snapshot = header();
+    const QByteArray records = QByteArray::fromRawData(reinterpret_cast<const char *>(mData) + sizeof(Header),
+                                                       size - sizeof(Header));
+    if (memcmp(snapshot->magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0
+            || snapshot->version != SnapshotVersion
+            || snapshot->size != quint32(records.size())
+            || QCryptographicHash::hash(records, QCryptographicHash::Md5)
+               != QByteArray::fromRawData(snapshot->checksum, sizeof(snapshot->checksum))) {
+        qWarning() << "Discarding invalid agenda snapshot" << mFile.fileName();
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void CalendarSnapshot::close()
+{
+    if (mData) {
+        mFile.unmap(const_cast<uchar *>(mData));
+        mData = 0;
+    }
+    mFile.close();
+}
+
+bool CalendarSnapshot::isCurrent() const
+{
+    return mData && databaseKey() == QByteArray::fromRawData(header()->key, sizeof(header()->key));
+}
+
+bool CalendarSnapshot::covers(const QDate &start, const QDate &end) const
+{
+    return mData && start.toJulianDay() >= header()->windowStart && end.toJulianDay() <= header()->windowEnd;
+}
+
+EventDataList CalendarSnapshot::events(const QDate &start, const QDate &end) const
+{
+    EventDataList events;
+    if (!mData)
+        return events;
+
+    const QByteArray records = QByteArray::fromRawData(reinterpret_cast<const char *>(mData) + sizeof(Header),
+                                                       header()->size);
+    QDataStream stream(records);
+    stream.setVersion(QDataStream::Qt_5_6);
+    for (quint32 i = 0; i < header()->count && stream.status() == QDataStream::Ok; ++i) {
+        quint32 size;
+        qint64 firstDay;
+        qint64 lastDay;
+        stream >> size >> firstDay >> lastDay;
+
+        // Same rule as CalendarManager::updateAgendaModel(), with the end
+        // day already adjusted for its inclusivity.
+        if (firstDay > end.toJulianDay()
+                || (firstDay < start.toJulianDay() && lastDay < start.toJulianDay())) {
+            stream.skipRawData(size);
+            continue;
+        }
+
+        EventData event;
+        stream >> event.calendarUid >> event.uniqueId >> event.recurrenceId
+               >> event.startTime >> event.endTime >> event.allDay >> event.color
+               >> event.displayLabel >> event.description >> event.location;
+        events << event;
+    }
+
+    return events;
+}
+
+bool CalendarSnapshot::write(const QDate &start, const QDate &end, const EventDataList &events,
+                             const QByteArray &key)
+{
+    QByteArray records;
+    QDataStream stream(&records, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    foreach (const EventData &event, events) {
+        QByteArray record;
+        QDataStream recordStream(&record, QIODevice::WriteOnly);
+        recordStream.setVersion(QDataStream::Qt_5_6);
+        recordStream << event.calendarUid << event.uniqueId << event.recurrenceId
+                     << event.startTime << event.endTime << event.allDay << event.color
+                     << event.displayLabel << event.description << event.location;
+
+        QDate firstDay;
+        QDate lastDay;
+        occurrenceDays(event, &firstDay, &lastDay);
+        stream << quint32(record.size()) << qint64(firstDay.toJulianDay()) << qint64(lastDay.toJulianDay());
+        stream.writeRawData(record.constData(), record.size());
+    }
+
+    Header snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    memcpy(snapshot.magic, SnapshotMagic, sizeof(SnapshotMagic));
+    snapshot.version = SnapshotVersion;
+    memcpy(snapshot.key, key.constData(), sizeof(snapshot.key));
+    const QByteArray checksum = QCryptographicHash::hash(records, QCryptographicHash::Md5);
+    memcpy(snapshot.checksum, checksum.constData(), sizeof(snapshot.checksum));
+    snapshot.windowStart = start.toJulianDay();
+    snapshot.windowEnd = end.toJulianDay();
+    snapshot.count = events.count();
+    snapshot.size = records.size();
+
+    QDir().mkpath(QFileInfo(fileName()).absolutePath());
+    QSaveFile file(fileName());
+    if (!file.open(QIODevice::WriteOnly)
+            || file.write(reinterpret_cast<const char *>(&snapshot), sizeof(snapshot)) != sizeof(snapshot)
+            || file.write(records) != records.size()
+            || !file.commit()) {
+        qWarning() << "Cannot write agenda snapshot" << fileName() << file.errorString();
+        return false;
+    }
+
+    // The previous mapping stays valid until then, the file being replaced.
+    return open();
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef CALENDARSNAPSHOT_H
+#define CALENDARSNAPSHOT_H
+
+#include <QtCore/QDate>
+#include <QtCore/QFile>
+
+#include "../common/eventdata.h"
+
+// A copy of the agenda for a window around the current day, kept on disk
+// so that the first requests after a start can be answered without
+// loading the calendar database. The file is memory mapped, and only
+// trusted while the database is unchanged since it was written.
+class CalendarSnapshot
+{
+public:
+    CalendarSnapshot();
+    ~CalendarSnapshot();
+
+    // The window to be saved, from a week ago to two months from now.
+    static QDate windowStart();
+    static QDate windowEnd();
+
+    // Maps the snapshot file, returns false if it is missing or corrupted.
+    bool open();
+    // True if the snapshot is mapped, and was written with the current database.
+    bool isCurrent() const;
+    bool covers(const QDate &start, const QDate &end) const;
+    // The occurrences of the snapshot in the given range, in agenda order.
+    EventDataList events(const QDate &start, const QDate &end) const;
+
+    // Identifies the state of the database, to be taken before loading
+    // the contents to write.
+    static QByteArray databaseKey();
+
+    // Replaces the snapshot with the given agenda contents, loaded from
+    // the database as identified by key.
+    bool write(const QDate &start, const QDate &end, const EventDataList &events,
+               const QByteArray &key);
+
+private:
+    Q_DISABLE_COPY(CalendarSnapshot)
+
+    struct Header;
+
+    void close();
+    const Header *header() const;
+    static QString fileName();
+
+    QFile mFile;
+    const uchar *mData;
+};
+
+#endif // CALENDARSNAPSHOT_H
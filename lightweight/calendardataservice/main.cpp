@@ -31,13 +31,35 @@
  */
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QSettings>
 
 #include "calendardataservice.h"
 
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
+
+    // The residency policy comes from the settings, and can be
+    // overridden on the command line.
+    QSettings settings("nemo", "nemo-qml-plugin-calendar");
+    int idleTimeout = settings.value("dataservice/idleTimeout", 2000).toInt();
+    bool persistent = settings.value("dataservice/persistent", false).toBool();
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption(QStringList() << "t" << "idle-timeout",
+                                        "exit after the given time without requests.", "ms"));
+    parser.addOption(QCommandLineOption(QStringList() << "p" << "persistent",
+                                        "keep running and keep the loaded events up to date."));
+    parser.process(app);
+    if (parser.isSet("idle-timeout"))
+        idleTimeout = parser.value("idle-timeout").toInt();
+    if (parser.isSet("persistent"))
+        persistent = true;
+
     CalendarDataService calendarDataService;
-    Q_UNUSED(calendarDataService)
+    calendarDataService.setIdleTimeout(idleTimeout);
+    calendarDataService.setPersistent(persistent);
     return app.exec();
 }
@@ -62,8 +62,52 @@ public Q_SLOTS:
         return asyncCallWithArgumentList(QLatin1String("getEvents"), argumentList);
     }
 
+    inline QDBusPendingReply<QString> getEventsV2(const QString &startDate, const QString &endDate)
+    {
+        QList<QVariant> argumentList;
+        argumentList << QVariant::fromValue(startDate) << QVariant::fromValue(endDate);
+        return asyncCallWithArgumentList(QLatin1String("getEventsV2"), argumentList);
+    }
+
+    inline QDBusPendingReply<QString> getEventsShared(const QString &startDate, const QString &endDate)
+    {
+        QList<QVariant> argumentList;
+        argumentList << QVariant::fromValue(startDate) << QVariant::fromValue(endDate);
+        return asyncCallWithArgumentList(QLatin1String("getEventsShared"), argumentList);
+    }
+
+    inline QDBusPendingReply<QString> subscribe(const QString &startDate, const QString &endDate,
+                                                const QVariantMap &filter)
+    {
+        QList<QVariant> argumentList;
+        argumentList << QVariant::fromValue(startDate) << QVariant::fromValue(endDate)
+                     << QVariant::fromValue(filter);
+        return asyncCallWithArgumentList(QLatin1String("subscribe"), argumentList);
+    }
+
+    inline QDBusPendingReply<> unsubscribe(const QString &subscriptionId)
+    {
+        QList<QVariant> argumentList;
+        argumentList << QVariant::fromValue(subscriptionId);
+        return asyncCallWithArgumentList(QLatin1String("unsubscribe"), argumentList);
+    }
+
+    inline QDBusPendingReply<> resync(const QString &subscriptionId)
+    {
+        QList<QVariant> argumentList;
+        argumentList << QVariant::fromValue(subscriptionId);
+        return asyncCallWithArgumentList(QLatin1String("resync"), argumentList);
+    }
+
 Q_SIGNALS:
     void getEventsResult(const QString &transactionId, const EventDataList &eventDataList);
+    void getEventsResultV2(const QString &transactionId, const CompactEventDataList &eventDataList);
+    void eventsChanged(const QString &subscriptionId, uint sequence, bool reset,
+                       const CompactEventDataList &added, const CompactEventDataList &changed,
+                       const QStringList &removed, int totalCount, qint64 expiryTime);
+    void dataChanged(const QStringList &ranges);
+    void getEventsResultShared(const QString &transactionId, const QDBusUnixFileDescriptor &segment);
+    void eventsChangedShared(const QString &subscriptionId, uint sequence, const QDBusUnixFileDescriptor &segment);
 };
 
 namespace org {
@@ -35,61 +35,64 @@
 #include <QDBusInterface>
 #include <QDBusPendingReply>
 #include <QDBusPendingCallWatcher>
+#include <QDBusServiceWatcher>
 #include <QDebug>
-#include <QFileSystemWatcher>
-#include <QFile>
-#include <QFileInfo>
-#include <QDir>
 #include <QColor>
+#include <QVector>
 #include <qqmlinfo.h>
 
 #include "calendardataserviceproxy.h"
+#include "../common/sharedsegment.h"
 
 CalendarEventsModel::CalendarEventsModel(QObject *parent) :
     QAbstractListModel(parent),
     mProxy(0),
-    mWatcher(new QFileSystemWatcher(this)),
     mFilterMode(FilterNone),
     mContentType(ContentAll),
     mEventLimit(1000),
     mTotalCount(0),
     mEventDisplayTime(0),
-    m_mkcalTracked(false)
+    mServiceWatcher(0),
+    mPendingSubscription(0),
+    mSequence(0),
+    mResyncPending(false)
 {
     registerCalendarDataServiceTypes();
     mProxy = new CalendarDataServiceProxy("org.nemomobile.calendardataservice",
                                           "/org/nemomobile/calendardataservice",
                                           QDBusConnection::sessionBus(),
                                           this);
-    connect(mProxy, SIGNAL(getEventsResult(QString,EventDataList)),
-            this, SLOT(getEventsResult(QString,EventDataList)));
+    connect(mProxy, SIGNAL(eventsChanged(QString,uint,bool,CompactEventDataList,CompactEventDataList,QStringList,int,qint64)),
+            this, SLOT(eventsChanged(QString,uint,bool,CompactEventDataList,CompactEventDataList,QStringList,int,qint64)));
 
-    mUpdateDelayTimer.setInterval(500);
-    mUpdateDelayTimer.setSingleShot(true);
-    connect(&mUpdateDelayTimer, SIGNAL(timeout()), this, SLOT(update()));
+    connect(mProxy, SIGNAL(eventsChangedShared(QString,uint,QDBusUnixFileDescriptor)),
+            this, SLOT(eventsChangedShared(QString,uint,QDBusUnixFileDescriptor)));
 
-    trackMkcal();
+    // The subscription is gone if the service went down.
+    mServiceWatcher = new QDBusServiceWatcher("org.nemomobile.calendardataservice",
+                                              QDBusConnection::sessionBus(),
+                                              QDBusServiceWatcher::WatchForUnregistration,
+                                              this);
+    connect(mServiceWatcher, SIGNAL(serviceUnregistered(QString)), this, SLOT(serviceUnregistered()));
 
-    QSettings settings("nemo", "nemo-qml-plugin-calendar");
-    QDir settingsDir(QFileInfo(settings.fileName()).absoluteDir());
-
-    if (!settingsDir.exists()) {
-        // forcefully create a settings path so changes can be followed
-        settingsDir.mkpath(QStringLiteral("."));
-    }
+    // Subscribed ranges get their changes with eventsChanged, this covers
+    // the time until the subscription is made.
+    connect(mProxy, SIGNAL(dataChanged(QStringList)), this, SLOT(serviceDataChanged(QStringList)));
 
-    if (!mWatcher->addPath(settingsDir.absolutePath())) {
-        qWarning() << "CalendarEventsModel: error following settings file changes" << settingsDir.absolutePath();
-    }
+    mUpdateDelayTimer.setInterval(500);
+    mUpdateDelayTimer.setSingleShot(true);
+    connect(&mUpdateDelayTimer, SIGNAL(timeout()), this, SLOT(update()));
+}
 
-    // Updates to the calendar db will cause several file change notifications, delay update a bit
-    connect(mWatcher, SIGNAL(directoryChanged(QString)), &mUpdateDelayTimer, SLOT(start()));
-    connect(mWatcher, SIGNAL(fileChanged(QString)), &mUpdateDelayTimer, SLOT(start())); // for mkcal tracking
+CalendarEventsModel::~CalendarEventsModel()
+{
+    if (!mSubscriptionId.isEmpty())
+        mProxy->unsubscribe(mSubscriptionId);
 }
 
 int CalendarEventsModel::count() const
 {
-    return qMin(mEventDataList.count(), mEventLimit);
+    return qMin(mEvents.count(), mEventLimit);
 }
 
 int CalendarEventsModel::totalCount() const
@@ -119,7 +122,7 @@ void CalendarEventsModel::setEventLimit(int limit)
 
     mEventLimit = limit;
     emit eventLimitChanged();
-    restartUpdateTimer(); // TODO: Could change list content without fetching data
+    restartUpdateTimer();
 }
 
 int CalendarEventsModel::eventDisplayTime() const
@@ -206,45 +209,37 @@ int CalendarEventsModel::rowCount(const QModelIndex &index) const
     if (index != QModelIndex())
         return 0;
 
-    return mEventDataList.count();
+    return mEvents.count();
 }
 
 QVariant CalendarEventsModel::data(const QModelIndex &index, int role) const
 {
-    if (!index.isValid() || index.row() >= mEventDataList.count())
+    if (!index.isValid() || index.row() >= mEvents.count())
         return QVariant();
 
-    EventData eventData = mEventDataList.at(index.row());
+    const Event &event = mEvents.at(index.row());
 
     switch(role) {
     case DisplayLabelRole:
-        return eventData.displayLabel;
+        return event.displayLabel;
     case DescriptionRole:
-        return eventData.description;
+        return event.description;
     case StartTimeRole:
-        if (eventData.allDay) {
-            return QDateTime(QDate::fromString(eventData.startTime, Qt::ISODate));
-        } else {
-            return QDateTime::fromString(eventData.startTime, Qt::ISODate);
-        }
+        return event.startTime;
     case EndTimeRole:
-        if (eventData.allDay) {
-            return QDateTime(QDate::fromString(eventData.endTime, Qt::ISODate));
-        } else {
-            return QDateTime::fromString(eventData.endTime, Qt::ISODate);
-        }
+        return event.endTime;
     case RecurrenceIdRole:
-        return eventData.recurrenceId;
+        return event.recurrenceId;
     case AllDayRole:
-        return eventData.allDay;
+        return event.allDay;
     case LocationRole:
-        return eventData.location;
+        return event.location;
     case CalendarUidRole:
-        return eventData.calendarUid;
+        return event.calendarUid;
     case UidRole:
-        return eventData.uniqueId;
+        return event.uniqueId;
     case ColorRole:
-        return QColor(eventData.color);
+        return event.color;
     default:
         return QVariant();
     }
@@ -252,91 +247,272 @@ QVariant CalendarEventsModel::data(const QModelIndex &index, int role) const
 
 void CalendarEventsModel::update()
 {
-    mTransactionId.clear();
-    QDateTime endDate = (mEndDate.isValid()) ? mEndDate : mStartDate;
-    QDBusPendingCall pcall = mProxy->getEvents(mStartDate.date().toString(Qt::ISODate),
-                                               endDate.date().toString(Qt::ISODate));
-    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pcall, this);
-    QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+    QDate startDate = mStartDate.date();
+    QDate endDate = (mEndDate.isValid()) ? mEndDate.date() : startDate;
+    // Filtering is done by the service, which also updates the events
+    // when they get filtered out with time.
+    QVariantMap filter;
+    filter.insert(QStringLiteral("contentType"), mContentType);
+    filter.insert(QStringLiteral("filterMode"), mFilterMode);
+    filter.insert(QStringLiteral("eventDisplayTime"), mEventDisplayTime);
+    filter.insert(QStringLiteral("limit"), mEventLimit);
+    // Large ranges are mapped from a shared segment instead of being
+    // copied through the bus.
+    if (QDBusConnection::sessionBus().connectionCapabilities() & QDBusConnection::UnixFileDescriptorPassing)
+        filter.insert(QStringLiteral("sharedMemory"), true);
+    if (startDate == mSubscribedStart && endDate == mSubscribedEnd && filter == mSubscribedFilter
+            && (!mSubscriptionId.isEmpty() || mPendingSubscription)) {
+        return;
+    }
+
+    if (!mSubscriptionId.isEmpty())
+        mProxy->unsubscribe(mSubscriptionId);
+    mSubscriptionId.clear();
+    mSubscribedStart = startDate;
+    mSubscribedEnd = endDate;
+    mSubscribedFilter = filter;
+
+    QDBusPendingCall pcall = mProxy->subscribe(startDate.toString(Qt::ISODate),
+                                               endDate.toString(Qt::ISODate),
+                                               filter);
+    mPendingSubscription = new QDBusPendingCallWatcher(pcall, this);
+    QObject::connect(mPendingSubscription, SIGNAL(finished(QDBusPendingCallWatcher*)),
                      this, SLOT(updateFinished(QDBusPendingCallWatcher*)));
 }
 
 void CalendarEventsModel::updateFinished(QDBusPendingCallWatcher *call)
 {
     QDBusPendingReply<QString> reply = *call;
-    if (reply.isError())
+    if (reply.isError()) {
         qWarning() << "dbus error:" << reply.error().name() << reply.error().message();
-    else
-        mTransactionId = reply.value();
+    } else if (call != mPendingSubscription) {
+        // Range changed meanwhile.
+        mProxy->unsubscribe(reply.value());
+    } else {
+        mSubscriptionId = reply.value();
+        mSequence = 0;
+        mResyncPending = false;
+    }
 
+    if (call == mPendingSubscription)
+        mPendingSubscription = 0;
     call->deleteLater();
 }
 
-void CalendarEventsModel::getEventsResult(const QString &transactionId, const EventDataList &eventDataList)
+void CalendarEventsModel::eventsChanged(const QString &subscriptionId, uint sequence, bool reset,
+                                        const CompactEventDataList &added,
+                                        const CompactEventDataList &changed,
+                                        const QStringList &removed,
+                                        int totalCount, qint64 expiryTime)
 {
-    // mkcal database didn't necessarily exist on startup but after calendar service has checked
-    // events it should be there.
-    trackMkcal();
+    if (mSubscriptionId.isEmpty() || mSubscriptionId != subscriptionId)
+        return;
+
+    if (!reset) {
+        if (mResyncPending)
+            return;
+        if (sequence != mSequence + 1) {
+            // An update got lost, start again from the full list.
+            qWarning() << "CalendarEventsModel: missed an update of" << subscriptionId << ", resyncing";
+            mResyncPending = true;
+            mProxy->resync(mSubscriptionId);
+            return;
+        }
+    }
+
+    mSequence = sequence;
+    mResyncPending = false;
+    if (reset)
+        mSubscribedEvents.clear();
+    foreach (const QString &key, removed)
+        mSubscribedEvents.remove(key);
+    insertEvents(added);
+    insertEvents(changed);
+    applyEvents(totalCount, expiryTime);
+}
 
-    if (mTransactionId != transactionId)
+void CalendarEventsModel::eventsChangedShared(const QString &subscriptionId, uint sequence,
+                                              const QDBusUnixFileDescriptor &segment)
+{
+    if (mSubscriptionId.isEmpty() || mSubscriptionId != subscriptionId)
         return;
 
-    int oldcount = mEventDataList.count();
-    int oldTotalCount = mTotalCount;
-    beginResetModel();
-    mEventDataList.clear();
-    QDateTime now = QDateTime::currentDateTime();
-    QDateTime expiryDate;
-    mTotalCount = 0;
-    foreach (const EventData &e, eventDataList) {
-        if ((e.allDay && mContentType == ContentEvents)
-                || (!e.allDay && mContentType == ContentAllDay)) {
-            continue;
+    SharedSegment sharedSegment(segment);
+    QByteArray data = sharedSegment.data();
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_6);
+    bool reset;
+    CompactEventDataList added;
+    CompactEventDataList changed;
+    QStringList removed;
+    qint32 totalCount;
+    qint64 expiryTime;
+    stream >> reset >> added >> changed >> removed >> totalCount >> expiryTime;
+    if (!sharedSegment.isValid() || stream.status() != QDataStream::Ok) {
+        qWarning() << "CalendarEventsModel: invalid update of" << subscriptionId << ", resyncing";
+        mResyncPending = true;
+        mProxy->resync(mSubscriptionId);
+        return;
+    }
+
+    eventsChanged(subscriptionId, sequence, reset, added, changed, removed, totalCount, expiryTime);
+}
+
+void CalendarEventsModel::serviceDataChanged(const QStringList &ranges)
+{
+    if (!mSubscriptionId.isEmpty() || mPendingSubscription || !mStartDate.isValid())
+        return;
+
+    QDate startDate = mStartDate.date();
+    QDate endDate = (mEndDate.isValid()) ? mEndDate.date() : startDate;
+    foreach (const QString &range, ranges) {
+        QDate changedStart = QDate::fromString(range.section(QLatin1Char('/'), 0, 0), Qt::ISODate);
+        QDate changedEnd = QDate::fromString(range.section(QLatin1Char('/'), 1, 1), Qt::ISODate);
+        if (changedStart <= endDate && changedEnd >= startDate) {
+            restartUpdateTimer();
+            return;
         }
+    }
+}
 
-        QDateTime startTime;
-        QDateTime endTime;
+void CalendarEventsModel::serviceUnregistered()
+{
+    if (mSubscriptionId.isEmpty() && !mPendingSubscription)
+        return;
+
+    mSubscriptionId.clear();
+    mPendingSubscription = 0;
+    mSubscribedStart = QDate();
+    mSubscribedEnd = QDate();
+    mSubscribedFilter.clear();
+    restartUpdateTimer();
+}
 
+void CalendarEventsModel::insertEvents(const CompactEventDataList &eventDataList)
+{
+    QVector<QColor> colors;
+    colors.reserve(eventDataList.notebooks.count());
+    foreach (const CompactNotebookData &notebook, eventDataList.notebooks)
+        colors.append(QColor(notebook.color));
+
+    foreach (const CompactEventData &e, eventDataList.events) {
+        Event event;
+        event.key = e.key();
+        event.displayLabel = e.displayLabel;
+        event.description = e.description;
         if (e.allDay) {
-            startTime = QDateTime(QDate::fromString(e.startTime, Qt::ISODate));
-            // returned value inclusive, need to know when event is over so getting the following day
-            endTime = QDateTime(QDate::fromString(e.endTime, Qt::ISODate).addDays(1));
+            // all day times are sent as UTC midnight of the (inclusive) dates
+            event.startTime = QDateTime(QDateTime::fromMSecsSinceEpoch(e.startTime, Qt::UTC).date());
+            event.endTime = QDateTime(QDateTime::fromMSecsSinceEpoch(e.endTime, Qt::UTC).date());
         } else {
-            startTime = QDateTime::fromString(e.startTime, Qt::ISODate);
+            event.startTime = QDateTime::fromMSecsSinceEpoch(e.startTime);
+            event.endTime = QDateTime::fromMSecsSinceEpoch(e.endTime);
+        }
+        event.recurrenceId = e.recurrenceId;
+        event.allDay = e.allDay;
+        event.location = e.location;
+        if (e.notebook >= 0 && e.notebook < colors.count()) {
+            event.calendarUid = eventDataList.notebooks.at(e.notebook).uid;
+            event.color = colors.at(e.notebook);
+        }
+        event.uniqueId = e.uniqueId;
+        mSubscribedEvents.insert(event.key, event);
+    }
+}
 
-            if (mEventDisplayTime > 0) {
-                endTime = startTime.addSecs(mEventDisplayTime);
-            } else {
-                endTime = QDateTime::fromString(e.endTime, Qt::ISODate);
-            }
+bool CalendarEventsModel::Event::operator==(const Event &other) const
+{
+    return key == other.key
+            && displayLabel == other.displayLabel
+            && description == other.description
+            && startTime == other.startTime
+            && endTime == other.endTime
+            && recurrenceId == other.recurrenceId
+            && allDay == other.allDay
+            && location == other.location
+            && calendarUid == other.calendarUid
+            && uniqueId == other.uniqueId
+            && color == other.color;
+}
+
+// Same order as CalendarAgendaModel
+bool CalendarEventsModel::eventLessThan(const Event &e1, const Event &e2)
+{
+    if (e1.startTime != e2.startTime)
+        return e1.startTime < e2.startTime;
+
+    int cmp = QString::compare(e1.displayLabel, e2.displayLabel, Qt::CaseInsensitive);
+    if (cmp != 0)
+        return cmp < 0;
+
+    return e1.key < e2.key;
+}
+
+// Updates the rows which differ from the subscribed events.
+void CalendarEventsModel::applyEvents(int totalCount, qint64 expiryTime)
+{
+    int oldcount = mEvents.count();
+    int oldTotalCount = mTotalCount;
+    mTotalCount = totalCount;
+
+    QList<Event> events = mSubscribedEvents.values();
+    qSort(events.begin(), events.end(), eventLessThan);
+
+    // Both lists are sorted, walk them removing, inserting and changing
+    // runs of rows as in CalendarAgendaModel::doRefresh().
+    int row = 0;
+    int newIndex = 0;
+    while (row < mEvents.count() || newIndex < events.count()) {
+        int removeCount = 0;
+        while (row + removeCount < mEvents.count()
+               && (newIndex >= events.count()
+                   || eventLessThan(mEvents.at(row + removeCount), events.at(newIndex)))) {
+            removeCount++;
+        }
+        if (removeCount) {
+            beginRemoveRows(QModelIndex(), row, row + removeCount - 1);
+            mEvents.erase(mEvents.begin() + row, mEvents.begin() + row + removeCount);
+            endRemoveRows();
+        }
+
+        int insertCount = 0;
+        while (newIndex + insertCount < events.count()
+               && (row >= mEvents.count()
+                   || eventLessThan(events.at(newIndex + insertCount), mEvents.at(row)))) {
+            insertCount++;
+        }
+        if (insertCount) {
+            beginInsertRows(QModelIndex(), row, row + insertCount - 1);
+            for (int i = 0; i < insertCount; ++i)
+                mEvents.insert(row + i, events.at(newIndex + i));
+            endInsertRows();
+            row += insertCount;
+            newIndex += insertCount;
         }
 
-        if ((mFilterMode == FilterPast && now < endTime)
-                || (mFilterMode == FilterPastAndCurrent && now < startTime)
-                || (mFilterMode == FilterNone)) {
-            if (mEventDataList.count() < mEventLimit) {
-                mEventDataList.append(e);
-
-                if (mFilterMode == FilterPast && (!expiryDate.isValid() || expiryDate > endTime)) {
-                    expiryDate = endTime;
-                } else if (mFilterMode == FilterPastAndCurrent && (!expiryDate.isValid() || expiryDate > startTime)) {
-                    expiryDate = startTime;
-                }
+        if (row < mEvents.count() && newIndex < events.count()
+                && !eventLessThan(mEvents.at(row), events.at(newIndex))
+                && !eventLessThan(events.at(newIndex), mEvents.at(row))) {
+            if (!(mEvents.at(row) == events.at(newIndex))) {
+                mEvents[row] = events.at(newIndex);
+                emit dataChanged(index(row), index(row));
             }
-            mTotalCount++;
+            row++;
+            newIndex++;
         }
     }
 
     mCreationDate = QDateTime::currentDateTime();
     emit creationDateChanged();
 
-    if (!expiryDate.isValid()) {
-        if (mEndDate.isValid()) {
-            expiryDate = mEndDate;
-        } else {
-            expiryDate = mStartDate.addDays(1);
-            expiryDate.setTime(QTime(0,0,0,1));
-        }
+    QDateTime expiryDate;
+    if (expiryTime > 0) {
+        expiryDate = QDateTime::fromMSecsSinceEpoch(expiryTime);
+    } else if (mEndDate.isValid()) {
+        expiryDate = mEndDate;
+    } else {
+        expiryDate = mStartDate.addDays(1);
+        expiryDate.setTime(QTime(0,0,0,1));
     }
 
     if (mExpiryDate != expiryDate) {
@@ -344,7 +520,6 @@ void CalendarEventsModel::getEventsResult(const QString &transactionId, const Ev
         emit expiryDateChanged();
     }
 
-    endResetModel();
     if (count() != oldcount) {
         emit countChanged();
     }
@@ -377,21 +552,3 @@ void CalendarEventsModel::restartUpdateTimer()
     else
         mUpdateDelayTimer.stop();
 }
-
-void CalendarEventsModel::trackMkcal()
-{
-    if (m_mkcalTracked) {
-        return;
-    }
-
-    QString privilegedDataDir = QString("%1/.local/share/system/privileged/Calendar/mkcal/db").arg(QDir::homePath());
-    if (QFile::exists(privilegedDataDir)) {
-        if (!mWatcher->addPath(privilegedDataDir)) {
-            qWarning() << "CalendarEventsModel: error adding filesystem watcher for calendar db";
-        } else {
-            m_mkcalTracked = true;
-        }
-    } else {
-        qWarning() << "CalendarEventsModel not following database changes, dir not found:" << privilegedDataDir;
-    }
-}
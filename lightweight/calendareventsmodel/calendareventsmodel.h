@@ -35,13 +35,15 @@
 
 #include <QAbstractListModel>
 #include <QDateTime>
+#include <QColor>
 #include <QTimer>
 
 #include "../common/eventdata.h"
 
 class QDBusPendingCallWatcher;
+class QDBusServiceWatcher;
+class QDBusUnixFileDescriptor;
 class CalendarDataServiceProxy;
-class QFileSystemWatcher;
 
 class CalendarEventsModel : public QAbstractListModel
 {
@@ -86,6 +88,7 @@ public:
     };
 
     explicit CalendarEventsModel(QObject *parent = 0);
+    ~CalendarEventsModel();
 
     QDateTime startDate() const;
     void setStartDate(const QDateTime &startDate);
@@ -133,19 +136,46 @@ public slots:
 
 private slots:
     void updateFinished(QDBusPendingCallWatcher *call);
-    void getEventsResult(const QString &transactionId, const EventDataList &eventDataList);
+    void eventsChanged(const QString &subscriptionId, uint sequence, bool reset,
+                       const CompactEventDataList &added, const CompactEventDataList &changed,
+                       const QStringList &removed, int totalCount, qint64 expiryTime);
+    void eventsChangedShared(const QString &subscriptionId, uint sequence, const QDBusUnixFileDescriptor &segment);
+    void serviceDataChanged(const QStringList &ranges);
+    void serviceUnregistered();
 
 protected:
     virtual QHash<int, QByteArray> roleNames() const;
 
 private:
+    // Parsed once when the result arrives, data() only reads these.
+    struct Event {
+        QString key;
+        QString displayLabel;
+        QString description;
+        QDateTime startTime;
+        QDateTime endTime;
+        QString recurrenceId;
+        bool allDay;
+        QString location;
+        QString calendarUid;
+        QString uniqueId;
+        QColor color;
+
+        bool operator==(const Event &other) const;
+    };
+
+    static bool eventLessThan(const Event &e1, const Event &e2);
+    void insertEvents(const CompactEventDataList &eventDataList);
+    void applyEvents(int totalCount, qint64 expiryTime);
+
     void restartUpdateTimer();
-    void trackMkcal();
 
     CalendarDataServiceProxy *mProxy;
-    QFileSystemWatcher *mWatcher;
     QTimer mUpdateDelayTimer;
-    EventDataList mEventDataList;
+    // All the events of the subscribed range, by CompactEventData::key(),
+    // and the filtered ones shown by the model.
+    QHash<QString, Event> mSubscribedEvents;
+    QList<Event> mEvents;
     QDateTime mStartDate;
     QDateTime mEndDate;
     QDateTime mCreationDate;
@@ -155,8 +185,14 @@ private:
     int mEventLimit;
     int mTotalCount;
     int mEventDisplayTime;
-    QString mTransactionId;
-    bool m_mkcalTracked;
+    QDBusServiceWatcher *mServiceWatcher;
+    QDBusPendingCallWatcher *mPendingSubscription;
+    QString mSubscriptionId;
+    QDate mSubscribedStart;
+    QDate mSubscribedEnd;
+    QVariantMap mSubscribedFilter;
+    uint mSequence;
+    bool mResyncPending;
 };
 
 #endif // CALENDAREVENTSMODEL_H
@@ -21,12 +21,14 @@ SOURCES += \
     calendardataserviceproxy.cpp \
     calendareventsmodel.cpp \
     ../common/eventdata.cpp \
+    ../common/sharedsegment.cpp \
     plugin.cpp
 
 HEADERS += \
     calendardataserviceproxy.h \
     calendareventsmodel.h \
-    ../common/eventdata.h
+    ../common/eventdata.h \
+    ../common/sharedsegment.h
 
 OTHER_FILES += qmldir
 
@@ -33,3 +33,136 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, EventData &eventD
     argument.endStructure();
     return argument;
 }
+
+QString CompactEventData::key() const
+{
+    return uniqueId + QLatin1Char('\n') + recurrenceId + QLatin1Char('\n') + QString::number(startTime);
+}
+
+int CompactEventDataList::notebookIndex(const QString &uid, const QString &color)
+{
+    for (int i = 0; i < notebooks.count(); ++i) {
+        if (notebooks.at(i).uid == uid && notebooks.at(i).color == color)
+            return i;
+    }
+    CompactNotebookData notebook = { uid, color };
+    notebooks.append(notebook);
+    return notebooks.count() - 1;
+}
+
+QDBusArgument &operator<<(QDBusArgument &argument, const CompactEventData &eventData)
+{
+    argument.beginStructure();
+    argument << eventData.uniqueId
+             << eventData.recurrenceId
+             << eventData.startTime
+             << eventData.endTime
+             << eventData.allDay
+             << eventData.notebook
+             << eventData.displayLabel
+             << eventData.description
+             << eventData.location;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, CompactEventData &eventData)
+{
+    argument.beginStructure();
+    argument >> eventData.uniqueId
+             >> eventData.recurrenceId
+             >> eventData.startTime
+             >> eventData.endTime
+             >> eventData.allDay
+             >> eventData.notebook
+             >> eventData.displayLabel
+             >> eventData.description
+             >> eventData.location;
+    argument.endStructure();
+    return argument;
+}
+
+QDBusArgument &operator<<(QDBusArgument &argument, const CompactNotebookData &notebookData)
+{
+    argument.beginStructure();
+    argument << notebookData.uid
+             << notebookData.color;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, CompactNotebookData &notebookData)
+{
+    argument.beginStructure();
+    argument >> notebookData.uid
+             >> notebookData.color;
+    argument.endStructure();
+    return argument;
+}
+
+QDBusArgument &operator<<(QDBusArgument &argument, const CompactEventDataList &eventDataList)
+{
+    argument.beginStructure();
+    argument << eventDataList.notebooks
+             << eventDataList.events;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, CompactEventDataList &eventDataList)
+{
+    argument.beginStructure();
+    argument >> eventDataList.notebooks
+             >> eventDataList.events;
+    argument.endStructure();
+    return argument;
+}
+
+QDataStream &operator<<(QDataStream &stream, const CompactEventData &eventData)
+{
+    return stream << eventData.uniqueId
+                  << eventData.recurrenceId
+                  << eventData.startTime
+                  << eventData.endTime
+                  << eventData.allDay
+                  << qint32(eventData.notebook)
+                  << eventData.displayLabel
+                  << eventData.description
+                  << eventData.location;
+}
+
+QDataStream &operator>>(QDataStream &stream, CompactEventData &eventData)
+{
+    qint32 notebook;
+    stream >> eventData.uniqueId
+           >> eventData.recurrenceId
+           >> eventData.startTime
+           >> eventData.endTime
+           >> eventData.allDay
+           >> notebook
+           >> eventData.displayLabel
+           >> eventData.description
+           >> eventData.location;
+    eventData.notebook = notebook;
+    return stream;
+}
+
+QDataStream &operator<<(QDataStream &stream, const CompactNotebookData &notebookData)
+{
+    return stream << notebookData.uid << notebookData.color;
+}
+
+QDataStream &operator>>(QDataStream &stream, CompactNotebookData &notebookData)
+{
+    return stream >> notebookData.uid >> notebookData.color;
+}
+
+QDataStream &operator<<(QDataStream &stream, const CompactEventDataList &eventDataList)
+{
+    return stream << eventDataList.notebooks << eventDataList.events;
+}
+
+QDataStream &operator>>(QDataStream &stream, CompactEventDataList &eventDataList)
+{
+    return stream >> eventDataList.notebooks >> eventDataList.events;
+}
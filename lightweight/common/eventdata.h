@@ -1,6 +1,7 @@
 #ifndef EVENTDATA_H
 #define EVENTDATA_H
 
+#include <QtCore/QDataStream>
 #include <QtCore/QList>
 #include <QtCore/QString>
 #include <QtDBus/QDBusMetaType>
@@ -26,9 +27,62 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, EventData &eventD
 typedef QList<EventData> EventDataList;
 Q_DECLARE_METATYPE(EventDataList)
 
+// Typed variant of EventData, as sent by getEventsResultV2.
+struct CompactEventData {
+    QString uniqueId;
+    QString recurrenceId;
+    // Milliseconds since the epoch. For all day events, the UTC
+    // midnight of the start and of the inclusive end dates.
+    qint64 startTime;
+    qint64 endTime;
+    bool allDay;
+    int notebook; // index in CompactEventDataList::notebooks
+    QString displayLabel;
+    QString description;
+    QString location;
+
+    // Identifies the occurrence in subscription updates.
+    QString key() const;
+};
+Q_DECLARE_METATYPE(CompactEventData)
+
+struct CompactNotebookData {
+    QString uid;
+    QString color;
+};
+Q_DECLARE_METATYPE(CompactNotebookData)
+
+// Events with their notebooks listed once.
+struct CompactEventDataList {
+    QList<CompactNotebookData> notebooks;
+    QList<CompactEventData> events;
+
+    // Returns the index of the notebook, adding it as needed.
+    int notebookIndex(const QString &uid, const QString &color);
+};
+Q_DECLARE_METATYPE(CompactEventDataList)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const CompactEventData &eventData);
+const QDBusArgument &operator>>(const QDBusArgument &argument, CompactEventData &eventData);
+QDBusArgument &operator<<(QDBusArgument &argument, const CompactNotebookData &notebookData);
+const QDBusArgument &operator>>(const QDBusArgument &argument, CompactNotebookData &notebookData);
+QDBusArgument &operator<<(QDBusArgument &argument, const CompactEventDataList &eventDataList);
+const QDBusArgument &operator>>(const QDBusArgument &argument, CompactEventDataList &eventDataList);
+
+// For payloads passed in a SharedSegment.
+QDataStream &operator<<(QDataStream &stream, const CompactEventData &eventData);
+QDataStream &operator>>(QDataStream &stream, CompactEventData &eventData);
+QDataStream &operator<<(QDataStream &stream, const CompactNotebookData &notebookData);
+QDataStream &operator>>(QDataStream &stream, CompactNotebookData &notebookData);
+QDataStream &operator<<(QDataStream &stream, const CompactEventDataList &eventDataList);
+QDataStream &operator>>(QDataStream &stream, CompactEventDataList &eventDataList);
+
 inline void registerCalendarDataServiceTypes() {
     qDBusRegisterMetaType<EventData>();
     qDBusRegisterMetaType<EventDataList>();
+    qDBusRegisterMetaType<CompactEventData>();
+    qDBusRegisterMetaType<CompactNotebookData>();
+    qDBusRegisterMetaType<CompactEventDataList>();
 }
 
 #endif // EVENTDATA_H
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "sharedsegment.h"
+
+#include <QtCore/QDebug>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SharedSegment::SharedSegment(const QDBusUnixFileDescriptor &fd)
+    : mData(0), mSize(0)
+{
+    struct stat info;
+    if (!fd.isValid() || fstat(fd.fileDescriptor(), &info) < 0 || info.st_size <= 0) {
+        qWarning() << "SharedSegment: invalid segment";
+        return;
+    }
+
+    void *data = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd.fileDescriptor(), 0);
+    if (data == MAP_FAILED) {
+        qWarning() << "SharedSegment: cannot map segment:" << strerror(errno);
+        return;
+    }
+    mData = static_cast<uchar *>(data);
+    mSize = info.st_size;
+}
+
+SharedSegment::~SharedSegment()
+{
+    if (mData)
+        munmap(mData, mSize);
+}
+
+bool SharedSegment::isValid() const
+{
+    return mData != 0;
+}
+
+QByteArray SharedSegment::data() const
+{
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(mData), int(mSize));
+}
+
+QDBusUnixFileDescriptor SharedSegment::create(const QByteArray &data)
+{
+    int fd = memfd_create("calendardataservice", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        qWarning() << "SharedSegment: cannot create segment:" << strerror(errno);
+        return QDBusUnixFileDescriptor();
+    }
+
+    qint64 written = 0;
+    while (written < data.size()) {
+        ssize_t count = write(fd, data.constData() + written, data.size() - written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0) {
+            qWarning() << "SharedSegment: cannot write segment:" << strerror(errno);
+            close(fd);
+            return QDBusUnixFileDescriptor();
+        }
+        written += count;
+    }
+
+    // The receivers map it as is, don't let it change under them.
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+        qWarning() << "SharedSegment: cannot seal segment:" << strerror(errno);
+
+    QDBusUnixFileDescriptor descriptor(fd); // duplicates it
+    close(fd);
+    return descriptor;
+}
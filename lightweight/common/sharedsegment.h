@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef SHAREDSEGMENT_H
+#define SHAREDSEGMENT_H
+
+#include <QtCore/QByteArray>
+#include <QtDBus/QDBusUnixFileDescriptor>
+
+// Sealed in-memory file passing a payload too large for a D-Bus message
+// as a file descriptor. The receiving side maps it instead of copying.
+class SharedSegment
+{
+public:
+    // Maps the segment behind the descriptor, read-only.
+    explicit SharedSegment(const QDBusUnixFileDescriptor &fd);
+    ~SharedSegment();
+
+    bool isValid() const;
+    // Refers to the mapping, valid as long as the segment is.
+    QByteArray data() const;
+
+    // Returns a descriptor for a new segment holding data, or an invalid
+    // one when the segment can't be created.
+    static QDBusUnixFileDescriptor create(const QByteArray &data);
+
+private:
+    Q_DISABLE_COPY(SharedSegment)
+
+    uchar *mData;
+    qint64 mSize;
+};
+
+#endif // SHAREDSEGMENT_H
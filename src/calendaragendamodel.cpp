@@ -36,6 +36,7 @@
 #include "calendarevent.h"
 #include "calendareventoccurrence.h"
 #include "calendarmanager.h"
+#include "calendartrace.h"
 
 #include <QDebug>
 
@@ -135,6 +136,9 @@ static bool eventsLessThan(const CalendarEventOccurrence *e1,
 
 void CalendarAgendaModel::doRefresh(QList<CalendarEventOccurrence *> newEvents)
 {
+    CalendarTraceSpan span("CalendarAgendaModel::doRefresh");
+    span.setCount("occurrences", newEvents.count());
+
     QList<CalendarEventOccurrence *> events = mEvents;
     QList<CalendarEventOccurrence *> skippedEvents;
 
@@ -220,6 +224,7 @@ void CalendarAgendaModel::doRefresh(QList<CalendarEventOccurrence *> newEvents)
         }
     }
 
+    span.setCount("unchanged", skippedEvents.count());
     qDeleteAll(skippedEvents);
 
     if (oldEventCount != mEvents.count())
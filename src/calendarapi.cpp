@@ -78,6 +78,11 @@ void CalendarApi::removeAll(const QString &uid)
     CalendarManager::instance()->save();
 }
 
+QVariantMap CalendarApi::statistics() const
+{
+    return CalendarManager::instance()->statistics();
+}
+
 QStringList CalendarApi::excludedNotebooks() const
 {
     return CalendarManager::instance()->excludedNotebooks();
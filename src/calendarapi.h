@@ -36,6 +36,7 @@
 #include <QStringList>
 #include <QDateTime>
 #include <QObject>
+#include <QVariantMap>
 
 class QJSEngine;
 class QQmlEngine;
@@ -58,6 +59,9 @@ public:
                             const QDateTime &time = QDateTime());
     Q_INVOKABLE void removeAll(const QString &uid); // remove all instances an event, all recurrenceIds
 
+    // Sizes of the cached data, load counts and latencies, for diagnostics
+    Q_INVOKABLE QVariantMap statistics() const;
+
     QStringList excludedNotebooks() const;
     void setExcludedNotebooks(const QStringList &);
 
@@ -35,6 +35,7 @@
 
 #include <QString>
 #include <QUrl>
+#include <QCryptographicHash>
 #include <QDateTime>
 
 // KCalendarCore
@@ -137,6 +138,20 @@ struct Attendee {
     }
 };
 
+struct Invitation {
+    QString file;       // path or URL of an .ics or .vcs file
+    QByteArray icsData; // raw iCalendar data, used when file is empty
+
+    // Identifies the invitation when reporting back a match. Inline
+    // data is identified by its digest, not to use whole calendars as keys.
+    QString key() const
+    {
+        return file.isEmpty()
+                ? QStringLiteral("ics:") + QString::fromLatin1(QCryptographicHash::hash(icsData, QCryptographicHash::Sha1).toHex())
+                : file;
+    }
+};
+
 struct EmailContact {
     EmailContact(const QString &aName, const QString &aEmail)
         : name(aName), email(aEmail) {}
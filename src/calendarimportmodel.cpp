@@ -32,32 +32,50 @@
 
 #include "calendarimportmodel.h"
 #include "calendarimportevent.h"
-#include "calendarutils.h"
+#include "calendarimportparser.h"
+#include "calendarimportwriter.h"
 
 #include <QtCore/QDebug>
-#include <QtCore/QFile>
-#include <QtCore/QUrl>
 
-// mkcal
-#include <extendedcalendar.h>
-#include <extendedstorage.h>
+#include <algorithm>
 
-// kcalendarcore
-#include <KCalendarCore/MemoryCalendar>
+namespace {
+    // Enough for the rows visible at a time.
+    const int MaxDecodedEvents = 50;
+}
 
 CalendarImportModel::CalendarImportModel(QObject *parent)
     : QAbstractListModel(parent),
-      mError(false)
+      mError(false),
+      mBusy(false),
+      mImporting(false),
+      mParser(0),
+      mWriter(0),
+      mRequest(0),
+      mImportRequest(0)
 {
+    qRegisterMetaType<QList<CalendarImportRow> >("QList<CalendarImportRow>");
+    qRegisterMetaType<QList<CalendarImportComponent> >("QList<CalendarImportComponent>");
+    mDecodedEvents.setMaxCost(MaxDecodedEvents);
 }
 
 CalendarImportModel::~CalendarImportModel()
 {
+    if (mParser) {
+        mParser->setRequest(-1);
+        mParserThread.quit();
+        mParserThread.wait();
+    }
+    if (mWriter) {
+        mWriter->setRequest(-1);
+        mWriterThread.quit();
+        mWriterThread.wait();
+    }
 }
 
 int CalendarImportModel::count() const
 {
-    return mEventList.count();
+    return mRows.count();
 }
 
 QString CalendarImportModel::fileName() const
@@ -96,12 +114,63 @@ bool CalendarImportModel::error() const
     return mError;
 }
 
+bool CalendarImportModel::busy() const
+{
+    return mBusy;
+}
+
+bool CalendarImportModel::importing() const
+{
+    return mImporting;
+}
+
 QObject *CalendarImportModel::getEvent(int index)
 {
-    if (index < 0 || index >= mEventList.count())
+    if (index < 0 || index >= mRows.count())
+        return 0;
+
+    // The objects are owned by QML, reuse those still alive.
+    const int id = mRows.at(index).id;
+    QPointer<CalendarImportEvent> eventObject = mEventObjects.value(id);
+    if (eventObject)
+        return eventObject;
+
+    KCalendarCore::Event::Ptr event = eventAt(index);
+    if (!event)
         return 0;
 
-    return new CalendarImportEvent(mEventList.at(index));
+    QHash<int, QPointer<CalendarImportEvent> >::iterator it = mEventObjects.begin();
+    while (it != mEventObjects.end()) {
+        if (it.value().isNull())
+            it = mEventObjects.erase(it);
+        else
+            ++it;
+    }
+
+    eventObject = new CalendarImportEvent(event);
+    mEventObjects.insert(id, eventObject);
+    return eventObject;
+}
+
+KCalendarCore::Event::Ptr CalendarImportModel::eventAt(int index) const
+{
+    const CalendarImportRow &row = mRows.at(index);
+    if (row.event)
+        return row.event;
+
+    KCalendarCore::Event::Ptr *cached = mDecodedEvents.object(row.id);
+    if (cached)
+        return *cached;
+
+    const KCalendarCore::Event::List events = CalendarImportParser::events(QList<CalendarImportRow>() << row,
+                                                                           mFileName, mIcsRawData, mContext);
+    if (events.isEmpty() || events.first()->uid() != row.uid) {
+        qWarning() << "Unable to decode imported event" << row.uid;
+        return KCalendarCore::Event::Ptr();
+    }
+
+    mDecodedEvents.insert(row.id, new KCalendarCore::Event::Ptr(events.first()));
+    return events.first();
 }
 
 int CalendarImportModel::rowCount(const QModelIndex &index) const
@@ -109,73 +178,103 @@ int CalendarImportModel::rowCount(const QModelIndex &index) const
     if (index != QModelIndex())
         return 0;
 
-    return mEventList.count();
+    return mRows.count();
 }
 
 QVariant CalendarImportModel::data(const QModelIndex &index, int role) const
 {
-    if (!index.isValid() || index.row() >= mEventList.count())
+    if (!index.isValid() || index.row() >= mRows.count())
         return QVariant();
 
-    KCalendarCore::Event::Ptr event = mEventList.at(index.row());
+    const CalendarImportRow &row = mRows.at(index.row());
 
     switch(role) {
     case DisplayLabelRole:
-        return event->summary();
+        return row.summary;
     case DescriptionRole:
-        return event->description();
+        return row.description;
     case StartTimeRole:
-        return event->dtStart();
+        return row.startTime;
     case EndTimeRole:
-        return event->dtEnd();
+        return row.endTime;
     case AllDayRole:
-        return event->allDay();
+        return row.allDay;
     case LocationRole:
-        return event->location();
+        return row.location;
     case UidRole:
-        return event->uid();
+        return row.uid;
     default:
         return QVariant();
     }
 }
-
 bool CalendarImportModel::importToNotebook(const QString &notebookUid)
 {
-    mKCal::ExtendedCalendar::Ptr calendar(new mKCal::ExtendedCalendar(QTimeZone::systemTimeZone()));
-    mKCal::ExtendedStorage::Ptr storage = calendar->defaultStorage(calendar);
-    bool success = false;
-
-    if (!storage->open()) {
-        qWarning() << "Unable to open calendar DB";
+    if (mImporting) {
+        qWarning() << "Already importing";
         return false;
     }
+    if (mFileName.isEmpty() && mIcsRawData.isEmpty())
+        return false;
 
-    if (!notebookUid.isEmpty()) {
-        if (! (storage->defaultNotebook() && storage->defaultNotebook()->uid() == notebookUid)) {
-            mKCal::Notebook::Ptr notebook = storage->notebook(notebookUid);
-            if (notebook) {
-                // TODO: should we change default notebook back if we change it?
-                storage->setDefaultNotebook(notebook);
-            } else {
-                qWarning() << "Invalid notebook UID" << notebookUid;
-                return false;
-            }
-        }
-    }
+    return CalendarImportWriter::importSource(mFileName, mIcsRawData, notebookUid);
+}
 
-    if (!mFileName.isEmpty()) {
-        success = CalendarUtils::importFromFile(mFileName, calendar);
-    } else {
-        success = CalendarUtils::importFromIcsRawData(mIcsRawData, calendar);
+bool CalendarImportModel::startImport(const QString &notebookUid)
+{
+    if (mBusy || mImporting) {
+        qWarning() << "Import data not ready or already importing";
+        return false;
     }
+    if (mFileName.isEmpty() && mIcsRawData.isEmpty())
+        return false;
 
-    if (success) {
-        storage->save();
-    }
+    // Reuse the events parsed for the model, streamed ones are
+    // decoded again from their location in the source.
+    startWriter();
+    ++mImportRequest;
+    mWriter->setRequest(mImportRequest);
+    setImporting(true);
+    QMetaObject::invokeMethod(mWriter, "importEvents", Qt::QueuedConnection,
+                              Q_ARG(int, mImportRequest),
+                              Q_ARG(QList<CalendarImportRow>, mRows),
+                              Q_ARG(QString, mFileName),
+                              Q_ARG(QByteArray, mIcsRawData),
+                              Q_ARG(QByteArray, mContext),
+                              Q_ARG(QString, notebookUid),
+                              Q_ARG(QList<CalendarImportComponent>, mOtherIncidences));
+    return true;
+}
+
+void CalendarImportModel::cancelImport()
+{
+    if (!mImporting)
+        return;
 
-    storage->close();
+    ++mImportRequest;
+    mWriter->setRequest(mImportRequest);
+    setImporting(false);
+    emit importFinished(false);
+}
 
-    return success;
+void CalendarImportModel::writerProgress(int request, int processed, int total)
+{
+    if (request == mImportRequest)
+        emit importProgress(processed, total);
+}
+
+void CalendarImportModel::writerEventFailed(int request, const QString &uid)
+{
+    if (request == mImportRequest)
+        emit importFailed(uid);
+}
+
+void CalendarImportModel::writerFinished(int request, bool success)
+{
+    if (request != mImportRequest)
+        return;
+
+    setImporting(false);
+    emit importFinished(success);
 }
 
 QHash<int, QByteArray> CalendarImportModel::roleNames() const
@@ -192,62 +291,138 @@ QHash<int, QByteArray> CalendarImportModel::roleNames() const
     return roleNames;
 }
 
-static bool incidenceLessThan(const KCalendarCore::Incidence::Ptr e1,
-                              const KCalendarCore::Incidence::Ptr e2)
+static bool rowLessThan(const CalendarImportRow &r1,
+                        const CalendarImportRow &r2)
 {
-    if (e1->dtStart() == e2->dtStart()) {
-        int cmp = QString::compare(e1->summary(),
-                                   e2->summary(),
+    if (r1.startTime == r2.startTime) {
+        int cmp = QString::compare(r1.summary,
+                                   r2.summary,
                                    Qt::CaseInsensitive);
         if (cmp == 0)
-            return QString::compare(e1->uid(), e2->uid()) < 0;
+            return QString::compare(r1.uid, r2.uid) < 0;
         else
             return cmp < 0;
     } else {
-        return e1->dtStart() < e2->dtStart();
+        return r1.startTime < r2.startTime;
     }
 }
 
 void CalendarImportModel::reload()
 {
-    if (!mFileName.isEmpty() || !mIcsRawData.isEmpty()) {
-        bool success = importToMemory(mFileName, mIcsRawData);
-        setError(!success);
-    } else if (!mEventList.isEmpty()) {
+    // Abandon any parse in progress.
+    ++mRequest;
+    if (mParser)
+        mParser->setRequest(mRequest);
+
+    mContext.clear();
+    mOtherIncidences.clear();
+    mDecodedEvents.clear();
+    mEventObjects.clear();
+    if (!mRows.isEmpty()) {
         beginResetModel();
-        mEventList.clear();
+        mRows.clear();
         endResetModel();
         emit countChanged();
+    }
+
+    if (!mFileName.isEmpty() || !mIcsRawData.isEmpty()) {
+        startParser();
+        mParser->setRequest(mRequest);
+        setBusy(true);
+        QMetaObject::invokeMethod(mParser, "parse", Qt::QueuedConnection,
+                                  Q_ARG(int, mRequest),
+                                  Q_ARG(QString, mFileName),
+                                  Q_ARG(QByteArray, mIcsRawData));
+    } else {
+        setBusy(false);
         setError(false);
     }
 }
 
-bool CalendarImportModel::importToMemory(const QString &fileName, const QByteArray &icsData)
+void CalendarImportModel::startParser()
 {
-    if (!mEventList.isEmpty())
-        mEventList.clear();
+    if (mParser)
+        return;
 
-    bool success = false;
+    mParser = new CalendarImportParser;
+    mParser->moveToThread(&mParserThread);
+    connect(&mParserThread, &QThread::finished, mParser, &QObject::deleteLater);
+    connect(mParser, &CalendarImportParser::rowsParsed,
+            this, &CalendarImportModel::rowsParsed);
+    connect(mParser, &CalendarImportParser::finished,
+            this, &CalendarImportModel::parseFinished);
 
-    beginResetModel();
-    KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::systemTimeZone()));
-    if (!fileName.isEmpty()) {
-        success = CalendarUtils::importFromFile(fileName, cal);
-    } else {
-        success = CalendarUtils::importFromIcsRawData(icsData, cal);
-    }
-    KCalendarCore::Incidence::List incidenceList = cal->incidences();
-    for (int i = 0; i < incidenceList.size(); i++) {
-        KCalendarCore::Incidence::Ptr incidence = incidenceList.at(i);
-        if (incidence->type() == KCalendarCore::IncidenceBase::TypeEvent)
-            mEventList.append(incidence.staticCast<KCalendarCore::Event>());
+    mParserThread.setObjectName("calendarimport");
+    mParserThread.start();
+}
+
+void CalendarImportModel::startWriter()
+{
+    if (mWriter)
+        return;
+
+    mWriter = new CalendarImportWriter;
+    mWriter->moveToThread(&mWriterThread);
+    connect(&mWriterThread, &QThread::finished, mWriter, &QObject::deleteLater);
+    connect(mWriter, &CalendarImportWriter::progress,
+            this, &CalendarImportModel::writerProgress);
+    connect(mWriter, &CalendarImportWriter::eventFailed,
+            this, &CalendarImportModel::writerEventFailed);
+    connect(mWriter, &CalendarImportWriter::finished,
+            this, &CalendarImportModel::writerFinished);
+
+    mWriterThread.setObjectName("calendarimportwriter");
+    mWriterThread.start();
+}
+
+void CalendarImportModel::rowsParsed(int request, const QList<CalendarImportRow> &rows,
+                                     const QByteArray &context)
+{
+    if (request != mRequest)
+        return;
+
+    if (!context.isEmpty())
+        mContext = context;
+
+    QList<CalendarImportRow> sorted(rows);
+    std::sort(sorted.begin(), sorted.end(), rowLessThan);
+
+    // Merge the batch into the sorted list, inserting runs of
+    // consecutive rows at once.
+    int row = 0;
+    int i = 0;
+    while (i < sorted.count()) {
+        row = std::upper_bound(mRows.begin() + row, mRows.end(),
+                               sorted.at(i), rowLessThan) - mRows.begin();
+        int last = i + 1;
+        while (last < sorted.count()
+               && (row == mRows.count() || !rowLessThan(mRows.at(row), sorted.at(last)))) {
+            ++last;
+        }
+
+        beginInsertRows(QModelIndex(), row, row + last - i - 1);
+        for (int j = i; j < last; ++j) {
+            mRows.insert(row++, sorted.at(j));
+        }
+        endInsertRows();
+        i = last;
     }
-    if (!mEventList.isEmpty())
-        qSort(mEventList.begin(), mEventList.end(), incidenceLessThan);
 
-    endResetModel();
     emit countChanged();
-    return success;
+}
+
+void CalendarImportModel::parseFinished(int request, bool success,
+                                        const QList<CalendarImportComponent> &otherIncidences,
+                                        const QByteArray &context)
+{
+    if (request != mRequest)
+        return;
+
+    if (!context.isEmpty())
+        mContext = context;
+    mOtherIncidences = otherIncidences;
+    setError(!success);
+    setBusy(false);
 }
 
 void CalendarImportModel::setError(bool error)
@@ -258,3 +433,19 @@ void CalendarImportModel::setError(bool error)
     }
 }
 
+void CalendarImportModel::setBusy(bool busy)
+{
+    if (busy != mBusy) {
+        mBusy = busy;
+        emit busyChanged();
+    }
+}
+
+void CalendarImportModel::setImporting(bool importing)
+{
+    if (importing != mImporting) {
+        mImporting = importing;
+        emit importingChanged();
+    }
+}
+
@@ -33,10 +33,15 @@
 #ifndef CALENDARIMPORT_H
 #define CALENDARIMPORT_H
 
+#include "calendarimportparser.h"
+
 #include <QAbstractListModel>
+#include <QThread>
+#include <QCache>
+#include <QPointer>
 
-// kcalendarcore
-#include <KCalendarCore/Calendar>
+class CalendarImportEvent;
+class CalendarImportWriter;
 
 class CalendarImportModel : public QAbstractListModel
 {
@@ -45,6 +50,8 @@ class CalendarImportModel : public QAbstractListModel
     Q_PROPERTY(QString fileName READ fileName WRITE setFileName NOTIFY fileNameChanged)
     Q_PROPERTY(QString icsString READ icsString WRITE setIcsString NOTIFY icsStringChanged)
     Q_PROPERTY(bool error READ error NOTIFY errorChanged)
+    Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
+    Q_PROPERTY(bool importing READ importing NOTIFY importingChanged)
 
 public:
     enum {
@@ -69,6 +76,8 @@ public:
     void setIcsString(const QString &icsData);
 
     bool error() const;
+    bool busy() const;
+    bool importing() const;
 
     virtual int rowCount(const QModelIndex &index) const;
     virtual QVariant data(const QModelIndex &index, int role) const;
@@ -81,22 +90,60 @@ signals:
     void fileNameChanged();
     void icsStringChanged();
     bool errorChanged();
+    void busyChanged();
+    void importingChanged();
+    void importProgress(int processed, int total);
+    void importFailed(const QString &uid);
+    void importFinished(bool success);
 
 public slots:
+    // Imports synchronously, returns whether the import succeeded.
     bool importToNotebook(const QString &notebookUid = QString());
+    // Imports in a worker thread, returns whether the import was started.
+    // The result is reported with importFinished().
+    bool startImport(const QString &notebookUid = QString());
+    void cancelImport();
 
 protected:
     virtual QHash<int, QByteArray> roleNames() const;
 
+private slots:
+    void rowsParsed(int request, const QList<CalendarImportRow> &rows, const QByteArray &context);
+    void parseFinished(int request, bool success, const QList<CalendarImportComponent> &otherIncidences,
+                       const QByteArray &context);
+    void writerProgress(int request, int processed, int total);
+    void writerEventFailed(int request, const QString &uid);
+    void writerFinished(int request, bool success);
+
 private:
     void reload();
-    bool importToMemory(const QString &fileName, const QByteArray &icsData);
     void setError(bool error);
+    void setBusy(bool busy);
+    void setImporting(bool importing);
+    void startParser();
+    void startWriter();
+    KCalendarCore::Event::Ptr eventAt(int index) const;
 
     QString mFileName;
     QByteArray mIcsRawData;
-    KCalendarCore::Event::List mEventList;
+    // Only the row summaries are kept for all events, full events are
+    // decoded on demand for getEvent() and a few of them cached.
+    QList<CalendarImportRow> mRows;
+    QByteArray mContext;
+    QList<CalendarImportComponent> mOtherIncidences;
+    mutable QCache<int, KCalendarCore::Event::Ptr> mDecodedEvents;
+    QHash<int, QPointer<CalendarImportEvent> > mEventObjects;
     bool mError;
+    bool mBusy;
+    bool mImporting;
+
+    QThread mParserThread;
+    CalendarImportParser *mParser;
+    // Imports have their own thread, not to hold off parsing.
+    QThread mWriterThread;
+    CalendarImportWriter *mWriter;
+    int mRequest;
+    int mImportRequest;
 };
 
 #endif // CALENDARIMPORT_H
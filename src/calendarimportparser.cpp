@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "calendarimportparser.h"
+#include "calendarutils.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QBuffer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QUrl>
+
+#include <algorithm>
+
+// kcalendarcore
+#include <KCalendarCore/ICalFormat>
+#include <KCalendarCore/MemoryCalendar>
+
+namespace {
+    // Smaller documents are parsed in one go, which also lets them
+    // benefit from the CalendarUtils parse cache.
+    const qint64 StreamingThreshold = 256 * 1024;
+    // Number of VEVENTs parsed and reported at a time.
+    const int BatchSize = 200;
+
+    const QByteArray CalendarEnd = QByteArrayLiteral("END:VCALENDAR\r\n");
+    // Tags the events of a chunk with their offset in the source.
+    const QByteArray OffsetProperty = QByteArrayLiteral("X-NEMO-IMPORT-OFFSET");
+
+    // Longer descriptions are cut in the row summaries, the full ones
+    // are decoded with the event.
+    const int MaxSummaryDescriptionLength = 512;
+
+    typedef QPair<qint64, int> SourceLocation;
+
+    QString localPath(const QString &fileName)
+    {
+        const QUrl url(fileName);
+        return url.isLocalFile() ? url.toLocalFile() : fileName;
+    }
+
+    // Parses the components at the given locations of the source, in the
+    // calendar context they were reported with.
+    bool decodeComponents(QList<SourceLocation> locations, const QString &fileName,
+                          const QByteArray &icsData, const QByteArray &context,
+                          KCalendarCore::MemoryCalendar::Ptr cal)
+    {
+        QFile file(localPath(fileName));
+        QBuffer buffer;
+        QIODevice *device = &file;
+        if (fileName.isEmpty()) {
+            buffer.setData(icsData);
+            device = &buffer;
+        }
+        if (!device->open(QIODevice::ReadOnly)) {
+            qWarning() << "Unable to open import data for reading" << fileName;
+            return false;
+        }
+
+        // Read in source order.
+        std::sort(locations.begin(), locations.end());
+
+        QByteArray chunk = context;
+        for (const SourceLocation &location : locations) {
+            if (!device->seek(location.first)) {
+                qWarning() << "Import data has changed" << fileName;
+                return false;
+            }
+            chunk += device->read(location.second);
+        }
+        chunk += CalendarEnd;
+
+        KCalendarCore::ICalFormat icalFormat;
+        if (!icalFormat.fromRawString(cal, chunk)) {
+            qWarning() << "Failed to decode imported incidences";
+            return false;
+        }
+        return true;
+    }
+}
+
+CalendarImportParser::CalendarImportParser()
+    : QObject(0)
+    , mRequest(0)
+    , mNextId(0)
+{
+}
+
+void CalendarImportParser::setRequest(int request)
+{
+    mRequest.storeRelease(request);
+}
+
+bool CalendarImportParser::cancelled(int request) const
+{
+    return mRequest.loadAcquire() != request;
+}
+
+KCalendarCore::Event::List CalendarImportParser::events(const QList<CalendarImportRow> &rows,
+                                                        const QString &fileName, const QByteArray &icsData,
+                                                        const QByteArray &context)
+{
+    KCalendarCore::Event::List result;
+    QList<SourceLocation> encoded;
+    for (const CalendarImportRow &row : rows) {
+        if (row.event)
+            result.append(row.event);
+        else
+            encoded.append(SourceLocation(row.offset, row.length));
+    }
+    if (encoded.isEmpty())
+        return result;
+
+    KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::systemTimeZone()));
+    if (decodeComponents(encoded, fileName, icsData, context, cal))
+        result += cal->rawEvents();
+    return result;
+}
+
+KCalendarCore::Incidence::List CalendarImportParser::incidences(const QList<CalendarImportComponent> &components,
+                                                                const QString &fileName,
+                                                                const QByteArray &icsData,
+                                                                const QByteArray &context)
+{
+    KCalendarCore::Incidence::List result;
+    QList<SourceLocation> encoded;
+    for (const CalendarImportComponent &component : components) {
+        if (component.incidence)
+            result.append(component.incidence);
+        else
+            encoded.append(SourceLocation(component.offset, component.length));
+    }
+    if (encoded.isEmpty())
+        return result;
+
+    KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::systemTimeZone()));
+    if (decodeComponents(encoded, fileName, icsData, context, cal)) {
+        for (const KCalendarCore::Todo::Ptr &todo : cal->rawTodos())
+            result.append(todo);
+        for (const KCalendarCore::Journal::Ptr &journal : cal->rawJournals())
+            result.append(journal);
+    }
+    return result;
+}
+
+void CalendarImportParser::parse(int request, const QString &fileName, const QByteArray &icsData)
+{
+    if (cancelled(request))
+        return;
+
+    mNextId = 0;
+    mOtherIncidences.clear();
+    mContext.clear();
+    bool success = false;
+    if (!fileName.isEmpty()) {
+        const QString filePath = localPath(fileName);
+        QFile file(filePath);
+        if (filePath.endsWith(".ics")
+                && QFileInfo(filePath).size() > StreamingThreshold
+                && file.open(QIODevice::ReadOnly)) {
+            success = parseStream(request, &file);
+        } else {
+            success = parseWhole(request, fileName, QByteArray());
+        }
+    } else if (icsData.size() > StreamingThreshold) {
+        QBuffer buffer;
+        buffer.setData(icsData);
+        buffer.open(QIODevice::ReadOnly);
+        success = parseStream(request, &buffer);
+    } else {
+        success = parseWhole(request, QString(), icsData);
+    }
+
+    if (!cancelled(request))
+        emit finished(request, success, mOtherIncidences, mContext);
+    mOtherIncidences.clear();
+    mContext.clear();
+}
+
+CalendarImportRow CalendarImportParser::createRow(const KCalendarCore::Event::Ptr &event)
+{
+    CalendarImportRow row;
+    row.id = mNextId++;
+    row.offset = 0;
+    row.length = 0;
+    row.uid = event->uid();
+    row.summary = event->summary();
+    row.description = event->description().left(MaxSummaryDescriptionLength);
+    row.location = event->location();
+    row.startTime = event->dtStart();
+    row.endTime = event->dtEnd();
+    row.allDay = event->allDay();
+    return row;
+}
+
+bool CalendarImportParser::parseWhole(int request, const QString &fileName, const QByteArray &icsData)
+{
+    KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::systemTimeZone()));
+    bool success;
+    if (!fileName.isEmpty()) {
+        success = CalendarUtils::importFromFile(fileName, cal);
+    } else {
+        success = CalendarUtils::importFromIcsRawData(icsData, cal);
+    }
+
+    // Small enough to keep, no need to decode again.
+    QList<CalendarImportRow> rows;
+    for (const KCalendarCore::Event::Ptr &event : cal->rawEvents()) {
+        CalendarImportRow row = createRow(event);
+        row.event = event;
+        rows.append(row);
+    }
+    if (!rows.isEmpty() && !cancelled(request))
+        emit rowsParsed(request, rows, QByteArray());
+    for (const KCalendarCore::Todo::Ptr &todo : cal->rawTodos()) {
+        CalendarImportComponent component = { 0, 0, todo };
+        mOtherIncidences.append(component);
+    }
+    for (const KCalendarCore::Journal::Ptr &journal : cal->rawJournals()) {
+        CalendarImportComponent component = { 0, 0, journal };
+        mOtherIncidences.append(component);
+    }
+
+    return success;
+}
+
+// Splits the document into VEVENT batches, each parsed as a calendar of its
+// own with the calendar properties and the time zones seen so far.
+// Only events are kept, todos and journals are only located.
+bool CalendarImportParser::parseStream(int request, QIODevice *device)
+{
+    QByteArray header;
+    QByteArray timeZones;
+    QByteArray component;
+    qint64 componentOffset = 0;
+    QByteArray batch;
+    QHash<qint64, int> lengths;
+    int depth = 0;
+    bool foundCalendar = false;
+    bool success = true;
+
+    while (!device->atEnd()) {
+        if (cancelled(request))
+            return false;
+
+        const qint64 lineOffset = device->pos();
+        const QByteArray line = device->readLine();
+        bool begin = false;
+        bool end = false;
+        QByteArray tag;
+        if (!line.isEmpty() && QByteArrayLiteral("BbEe").contains(line.at(0))) {
+            tag = line.trimmed().toUpper();
+            begin = tag.startsWith("BEGIN:");
+            end = tag.startsWith("END:");
+        }
+
+        if (begin && ++depth == 1) {
+            // BEGIN:VCALENDAR
+            header = line;
+            foundCalendar = true;
+        } else if (depth == 1 && end) {
+            // END:VCALENDAR
+            --depth;
+            if (!lengths.isEmpty())
+                success &= parseChunk(request, header + timeZones + batch + CalendarEnd,
+                                      lengths, header + timeZones);
+            batch.clear();
+            lengths.clear();
+        } else if (depth == 1) {
+            header += line;
+        } else if (depth > 1) {
+            if (component.isEmpty())
+                componentOffset = lineOffset;
+            if (end && depth == 2) {
+                const QByteArray name = tag.mid(4);
+                if (name == "VTIMEZONE") {
+                    timeZones += component + line;
+                } else if (name == "VEVENT") {
+                    batch += component + OffsetProperty + ':' + QByteArray::number(componentOffset)
+                            + "\r\n" + line;
+                    lengths.insert(componentOffset, int(device->pos() - componentOffset));
+                    if (lengths.count() >= BatchSize) {
+                        success &= parseChunk(request, header + timeZones + batch + CalendarEnd,
+                                              lengths, header + timeZones);
+                        batch.clear();
+                        lengths.clear();
+                    }
+                } else if (name == "VTODO" || name == "VJOURNAL") {
+                    CalendarImportComponent other = { componentOffset, int(device->pos() - componentOffset),
+                                                      KCalendarCore::Incidence::Ptr() };
+                    mOtherIncidences.append(other);
+                }
+                component.clear();
+            } else {
+                component += line;
+            }
+            if (end)
+                --depth;
+        }
+    }
+
+    // Truncated document, parse what we have.
+    if (!lengths.isEmpty())
+        success &= parseChunk(request, header + timeZones + batch + CalendarEnd,
+                              lengths, header + timeZones);
+
+    if (!foundCalendar)
+        qWarning() << "No calendar found in import data";
+    mContext = header + timeZones;
+
+    return success && foundCalendar;
+}
+
+bool CalendarImportParser::parseChunk(int request, const QByteArray &chunk, const QHash<qint64, int> &lengths,
+                                      const QByteArray &context)
+{
+    KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::systemTimeZone()));
+    KCalendarCore::ICalFormat icalFormat;
+    if (!icalFormat.fromRawString(cal, chunk)) {
+        qWarning() << "Failed to import a part of the data";
+        return false;
+    }
+
+    // Only the summaries are kept, the events are dropped with the calendar.
+    QList<CalendarImportRow> rows;
+    for (const KCalendarCore::Event::Ptr &event : cal->rawEvents()) {
+        bool ok = false;
+        const qint64 offset = event->nonKDECustomProperty(OffsetProperty).toLongLong(&ok);
+        if (!ok || !lengths.contains(offset))
+            continue;
+        CalendarImportRow row = createRow(event);
+        row.offset = offset;
+        row.length = lengths.value(offset);
+        rows.append(row);
+    }
+    if (!rows.isEmpty() && !cancelled(request))
+        emit rowsParsed(request, rows, context);
+
+    return true;
+}
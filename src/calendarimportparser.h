@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef CALENDARIMPORTPARSER_H
+#define CALENDARIMPORTPARSER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QList>
+#include <QHash>
+
+// kcalendarcore
+#include <KCalendarCore/Event>
+
+class QIODevice;
+
+// Summary of an event to import. Events of streamed documents are not kept
+// in memory, they are decoded again from their location in the source.
+struct CalendarImportRow {
+    int id;
+    // Location of the VEVENT in streamed sources.
+    qint64 offset;
+    int length;
+    QString uid;
+    QString summary;
+    QString description; // possibly cut
+    QString location;
+    QDateTime startTime;
+    QDateTime endTime;
+    bool allDay;
+    KCalendarCore::Event::Ptr event; // set when the document was parsed whole
+};
+
+// Todo or journal to import. They aren't shown, streamed ones are only
+// located and get decoded by the import.
+struct CalendarImportComponent {
+    qint64 offset;
+    int length;
+    KCalendarCore::Incidence::Ptr incidence; // set when the document was parsed whole
+};
+
+// Parses import data in a worker thread, reporting the events in batches
+// as they are parsed. Large iCalendar documents are split on VEVENT
+// boundaries and parsed piecewise, so the whole document never needs to
+// be held or parsed in one go.
+class CalendarImportParser : public QObject
+{
+    Q_OBJECT
+
+public:
+    CalendarImportParser();
+
+    // Thread safe, parse requests with an other id are abandoned.
+    void setRequest(int request);
+
+    // Returns the events of the given rows, decoding them from the source
+    // if needed. context is the calendar data reported with the rows.
+    static KCalendarCore::Event::List events(const QList<CalendarImportRow> &rows,
+                                             const QString &fileName, const QByteArray &icsData,
+                                             const QByteArray &context);
+    // Same for todos and journals.
+    static KCalendarCore::Incidence::List incidences(const QList<CalendarImportComponent> &components,
+                                                     const QString &fileName, const QByteArray &icsData,
+                                                     const QByteArray &context);
+
+public slots:
+    void parse(int request, const QString &fileName, const QByteArray &icsData);
+
+signals:
+    void rowsParsed(int request, const QList<CalendarImportRow> &rows, const QByteArray &context);
+    // otherIncidences are the todos and journals, which aren't shown
+    // but still get imported. context is the calendar data of the whole
+    // document, for decoding them.
+    void finished(int request, bool success, const QList<CalendarImportComponent> &otherIncidences,
+                  const QByteArray &context);
+
+private:
+    bool parseWhole(int request, const QString &fileName, const QByteArray &icsData);
+    bool parseStream(int request, QIODevice *device);
+    bool parseChunk(int request, const QByteArray &chunk, const QHash<qint64, int> &lengths,
+                    const QByteArray &context);
+    bool cancelled(int request) const;
+    CalendarImportRow createRow(const KCalendarCore::Event::Ptr &event);
+
+    QAtomicInt mRequest;
+    int mNextId;
+    QList<CalendarImportComponent> mOtherIncidences;
+    QByteArray mContext;
+};
+
+#endif // CALENDARIMPORTPARSER_H
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "calendarimportwriter.h"
+
+#include "calendarutils.h"
+
+#include <QtCore/QDebug>
+
+// mkcal
+#include <extendedcalendar.h>
+#include <extendedstorage.h>
+
+// kcalendarcore
+#include <KCalendarCore/MemoryCalendar>
+
+namespace {
+    // Number of events committed to the database at a time.
+    const int BatchSize = 100;
+
+    bool parseSource(const QString &fileName, const QByteArray &icsData,
+                     KCalendarCore::MemoryCalendar::Ptr cal)
+    {
+        return fileName.isEmpty()
+                ? CalendarUtils::importFromIcsRawData(icsData, cal)
+                : CalendarUtils::importFromFile(fileName, cal);
+    }
+
+    // Resolves the notebook to import to, the default one if none is given.
+    bool targetNotebook(mKCal::ExtendedStorage::Ptr storage, const QString &notebookUid, QString *target)
+    {
+        *target = notebookUid;
+        if (target->isEmpty()) {
+            if (storage->defaultNotebook())
+                *target = storage->defaultNotebook()->uid();
+        } else if (!storage->notebook(*target)) {
+            qWarning() << "Invalid notebook UID" << *target;
+            return false;
+        }
+        return true;
+    }
+
+    // Adds a copy, the original may still be shown by the model, or
+    // come from the parse cache.
+    bool addIncidence(mKCal::ExtendedCalendar::Ptr calendar, const KCalendarCore::Incidence::Ptr &original,
+                      const QString &notebookUid)
+    {
+        KCalendarCore::Incidence::Ptr incidence(original->clone());
+        bool added = false;
+        switch (incidence->type()) {
+        case KCalendarCore::IncidenceBase::TypeEvent:
+            added = calendar->addEvent(incidence.staticCast<KCalendarCore::Event>(), notebookUid);
+            break;
+        case KCalendarCore::IncidenceBase::TypeTodo:
+            added = calendar->addTodo(incidence.staticCast<KCalendarCore::Todo>(), notebookUid);
+            break;
+        case KCalendarCore::IncidenceBase::TypeJournal:
+            added = calendar->addJournal(incidence.staticCast<KCalendarCore::Journal>(), notebookUid);
+            break;
+        default:
+            break;
+        }
+        if (!added)
+            qWarning() << "Unable to import incidence" << incidence->uid();
+        return added;
+    }
+}
+
+CalendarImportWriter::CalendarImportWriter()
+    : QObject(0)
+    , mRequest(0)
+{
+}
+
+void CalendarImportWriter::setRequest(int request)
+{
+    mRequest.storeRelease(request);
+}
+
+bool CalendarImportWriter::cancelled(int request) const
+{
+    return mRequest.loadAcquire() != request;
+}
+
+bool CalendarImportWriter::importSource(const QString &fileName, const QByteArray &icsData,
+                                        const QString &notebookUid)
+{
+    KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::systemTimeZone()));
+    if (!parseSource(fileName, icsData, cal))
+        return false;
+
+    mKCal::ExtendedCalendar::Ptr calendar(new mKCal::ExtendedCalendar(QTimeZone::systemTimeZone()));
+    mKCal::ExtendedStorage::Ptr storage = calendar->defaultStorage(calendar);
+    if (!storage->open()) {
+        qWarning() << "Unable to open calendar DB";
+        return false;
+    }
+
+    QString targetNotebookUid;
+    if (!targetNotebook(storage, notebookUid, &targetNotebookUid)) {
+        storage->close();
+        return false;
+    }
+
+    bool success = true;
+    for (const KCalendarCore::Incidence::Ptr &incidence : cal->rawIncidences())
+        success &= addIncidence(calendar, incidence, targetNotebookUid);
+    if (!storage->save()) {
+        qWarning() << "Unable to save imported incidences";
+        success = false;
+    }
+
+    storage->close();
+    return success;
+}
+
+void CalendarImportWriter::importEvents(int request, const QList<CalendarImportRow> &rows,
+                                        const QString &fileName, const QByteArray &icsData,
+                                        const QByteArray &context, const QString &notebookUid,
+                                        const QList<CalendarImportComponent> &otherIncidences)
+{
+    if (cancelled(request))
+        return;
+
+    mKCal::ExtendedCalendar::Ptr calendar(new mKCal::ExtendedCalendar(QTimeZone::systemTimeZone()));
+    mKCal::ExtendedStorage::Ptr storage = calendar->defaultStorage(calendar);
+
+    if (!storage->open()) {
+        qWarning() << "Unable to open calendar DB";
+        emit finished(request, false);
+        return;
+    }
+
+    QString targetNotebookUid;
+    if (!targetNotebook(storage, notebookUid, &targetNotebookUid)) {
+        storage->close();
+        emit finished(request, false);
+        return;
+    }
+
+    bool success = true;
+    const int total = rows.count() + otherIncidences.count();
+    for (int i = 0; i < rows.count(); i += BatchSize) {
+        if (cancelled(request)) {
+            storage->close();
+            return;
+        }
+
+        const QList<CalendarImportRow> batch = rows.mid(i, BatchSize);
+        const KCalendarCore::Event::List events = CalendarImportParser::events(batch, fileName,
+                                                                               icsData, context);
+        if (events.count() != batch.count()) {
+            qWarning() << "Unable to decode all imported events";
+            success = false;
+        }
+
+        for (const KCalendarCore::Event::Ptr &event : events) {
+            if (!addIncidence(calendar, event, targetNotebookUid)) {
+                success = false;
+                emit eventFailed(request, event->uid());
+            }
+        }
+
+        if (!storage->save()) {
+            qWarning() << "Unable to save imported events";
+            success = false;
+        }
+        emit progress(request, i + batch.count(), total);
+    }
+
+    for (int i = 0; i < otherIncidences.count(); i += BatchSize) {
+        if (cancelled(request)) {
+            storage->close();
+            return;
+        }
+
+        const QList<CalendarImportComponent> batch = otherIncidences.mid(i, BatchSize);
+        const KCalendarCore::Incidence::List incidences = CalendarImportParser::incidences(batch, fileName,
+                                                                                           icsData, context);
+        if (incidences.count() != batch.count()) {
+            qWarning() << "Unable to decode all imported todos and journals";
+            success = false;
+        }
+
+        for (const KCalendarCore::Incidence::Ptr &incidence : incidences) {
+            if (!addIncidence(calendar, incidence, targetNotebookUid)) {
+                success = false;
+                emit eventFailed(request, incidence->uid());
+            }
+        }
+
+        if (!storage->save()) {
+            qWarning() << "Unable to save imported todos and journals";
+            success = false;
+        }
+        emit progress(request, rows.count() + i + batch.count(), total);
+    }
+
+    storage->close();
+    emit finished(request, success);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef CALENDARIMPORTWRITER_H
+#define CALENDARIMPORTWRITER_H
+
+#include "calendarimportparser.h"
+
+#include <QObject>
+#include <QAtomicInt>
+
+// Stores imported events to the calendar database from a worker thread,
+// committing them in batches and reporting the progress. Streamed events,
+// todos and journals are decoded again from their location in the source.
+class CalendarImportWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    CalendarImportWriter();
+
+    // Thread safe, imports with an other id are cancelled. Batches
+    // already committed stay in the database.
+    void setRequest(int request);
+
+    // Synchronous import of all the incidences of the source, from the
+    // calling thread.
+    static bool importSource(const QString &fileName, const QByteArray &icsData,
+                             const QString &notebookUid);
+
+public slots:
+    void importEvents(int request, const QList<CalendarImportRow> &rows,
+                      const QString &fileName, const QByteArray &icsData,
+                      const QByteArray &context, const QString &notebookUid,
+                      const QList<CalendarImportComponent> &otherIncidences);
+
+signals:
+    void progress(int request, int processed, int total);
+    void eventFailed(int request, const QString &uid);
+    void finished(int request, bool success);
+
+private:
+    bool cancelled(int request) const;
+
+    QAtomicInt mRequest;
+};
+
+#endif // CALENDARIMPORTWRITER_H
@@ -75,6 +75,11 @@ QString CalendarInvitationQuery::invitationFile() const
     return mInvitationFile;
 }
 
+QString CalendarInvitationQuery::icsString() const
+{
+    return mIcsString;
+}
+
 bool CalendarInvitationQuery::busy() const
 {
     return mBusy;
@@ -90,6 +95,16 @@ void CalendarInvitationQuery::setInvitationFile(const QString &file)
     query();
 }
 
+void CalendarInvitationQuery::setIcsString(const QString &icsData)
+{
+    if (mIcsString != icsData) {
+        mIcsString = icsData;
+        emit icsStringChanged();
+    }
+
+    query();
+}
+
 void CalendarInvitationQuery::classBegin()
 {
     mIsComplete = false;
@@ -105,7 +120,7 @@ void CalendarInvitationQuery::componentComplete()
 
 void CalendarInvitationQuery::query()
 {
-    if (!mInvitationFile.isEmpty()) {
+    if (!mInvitationFile.isEmpty() || !mIcsString.isEmpty()) {
         // note: we allow scheduling the query even if mBusy is true
         // as the client could have changed the invitation file
         // and in that case, the old query is orphaned by the manager.
@@ -116,7 +131,14 @@ void CalendarInvitationQuery::query()
         }
 
         if (mIsComplete) {
-            CalendarManager::instance()->scheduleInvitationQuery(this, mInvitationFile);
+            // invitationFile takes precedence over icsString when both are set
+            CalendarData::Invitation invitation;
+            if (mInvitationFile.isEmpty()) {
+                invitation.icsData = mIcsString.toUtf8();
+            } else {
+                invitation.file = mInvitationFile;
+            }
+            CalendarManager::instance()->scheduleInvitationQuery(this, invitation);
         } else {
             mNeedQuery = true;
         }
@@ -45,6 +45,7 @@ class CalendarInvitationQuery : public QObject, public QQmlParserStatus
     Q_OBJECT
     Q_INTERFACES(QQmlParserStatus)
     Q_PROPERTY(QString invitationFile READ invitationFile WRITE setInvitationFile NOTIFY invitationFileChanged)
+    Q_PROPERTY(QString icsString READ icsString WRITE setIcsString NOTIFY icsStringChanged)
     Q_PROPERTY(QString notebookUid READ notebookUid NOTIFY notebookUidChanged)
     Q_PROPERTY(QString uid READ uid NOTIFY uidChanged)
     Q_PROPERTY(QString rid READ rid NOTIFY ridChanged)
@@ -58,6 +59,9 @@ public:
     QString invitationFile() const;
     void setInvitationFile(const QString &file);
 
+    QString icsString() const;
+    void setIcsString(const QString &icsData);
+
     QString notebookUid() const;
     QString uid() const;
     QString rid() const;
@@ -72,6 +76,7 @@ public:
 
 signals:
     void invitationFileChanged();
+    void icsStringChanged();
     void notebookUidChanged();
     void uidChanged();
     void ridChanged();
@@ -88,6 +93,7 @@ private:
     bool mBusy;
 
     QString mInvitationFile;
+    QString mIcsString;
     QString mNotebookUid;
     QString mUid;
     QString mRid;
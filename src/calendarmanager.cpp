@@ -34,19 +34,32 @@
 
 #include <QDebug>
 
+#include <algorithm>
+
 #include "calendarworker.h"
+#include "calendarreader.h"
 #include "calendarevent.h"
 #include "calendaragendamodel.h"
 #include "calendareventoccurrence.h"
 #include "calendareventquery.h"
 #include "calendarinvitationquery.h"
 #include "calendarchangeinformation.h"
+#include "calendartrace.h"
+#include "calendarutils.h"
 
 // kcalendarcore
 #include <KCalendarCore/CalFormat>
 
+// Number of read-only storage connections, the writer
+// is always kept on its own connection.
+static const int MaxReaderCount = 2;
+
+// Number of loadData() round trips kept for the latency statistics.
+static const int MaxLoadLatencyCount = 100;
+
 CalendarManager::CalendarManager()
-    : mLoadPending(false), mResetPending(false)
+    : mNextReader(0), mQueuedWrites(0), mSavedWrites(0), mLoadPending(false), mResetPending(false),
+      mLoadCount(0), mResetCount(0), mRangeHitCount(0), mRangeMissCount(0)
 {
     qRegisterMetaType<QList<QDateTime> >("QList<QDateTime>");
     qRegisterMetaType<CalendarEvent::Recur>("CalendarEvent::Recur");
@@ -58,6 +71,7 @@ CalendarManager::CalendarManager()
     qRegisterMetaType<QList<CalendarData::Range > >("QList<CalendarData::Range>");
     qRegisterMetaType<QList<CalendarData::Notebook> >("QList<CalendarData::Notebook>");
     qRegisterMetaType<QList<CalendarData::EmailContact> >("QList<CalendarData::EmailContact>");
+    qRegisterMetaType<QList<CalendarData::Invitation> >("QList<CalendarData::Invitation>");
 
     mCalendarWorker = new CalendarWorker();
     mCalendarWorker->moveToThread(&mWorkerThread);
@@ -66,6 +80,8 @@ CalendarManager::CalendarManager()
 
     connect(mCalendarWorker, &CalendarWorker::storageModifiedSignal,
             this, &CalendarManager::storageModifiedSlot);
+    connect(mCalendarWorker, &CalendarWorker::saved,
+            this, &CalendarManager::savedSlot);
 
     connect(mCalendarWorker, &CalendarWorker::eventNotebookChanged,
             this, &CalendarManager::eventNotebookChanged);
@@ -83,18 +99,38 @@ CalendarManager::CalendarManager()
     connect(mCalendarWorker, &CalendarWorker::occurrenceExceptionCreated,
             this, &CalendarManager::occurrenceExceptionCreatedSlot);
 
-    connect(mCalendarWorker, &CalendarWorker::findMatchingEventFinished,
-            this, &CalendarManager::findMatchingEventFinished);
-
     mWorkerThread.setObjectName("calendarworker");
     mWorkerThread.start();
 
     QMetaObject::invokeMethod(mCalendarWorker, "init", Qt::QueuedConnection);
 
+    const int readerCount = qBound(1, QThread::idealThreadCount() - 1, MaxReaderCount);
+    for (int i = 0; i < readerCount; ++i) {
+        QThread *thread = new QThread(this);
+        CalendarReader *reader = new CalendarReader();
+        reader->moveToThread(thread);
+
+        connect(thread, &QThread::finished, reader, &QObject::deleteLater);
+        connect(reader, &CalendarReader::findMatchingEventFinished,
+                this, &CalendarManager::findMatchingEventFinished);
+
+        thread->setObjectName(QString::fromLatin1("calendarreader%1").arg(i));
+        thread->start();
+        QMetaObject::invokeMethod(reader, "init", Qt::QueuedConnection);
+
+        mReaderThreads.append(thread);
+        mCalendarReaders.append(reader);
+    }
+
     mTimer = new QTimer(this);
     mTimer->setSingleShot(true);
     mTimer->setInterval(5);
     connect(mTimer, SIGNAL(timeout()), this, SLOT(timeout()));
+
+    mInvitationTimer = new QTimer(this);
+    mInvitationTimer->setSingleShot(true);
+    mInvitationTimer->setInterval(5);
+    connect(mInvitationTimer, &QTimer::timeout, this, &CalendarManager::sendInvitationQueries);
 }
 
 static CalendarManager *managerInstance = nullptr;
@@ -109,6 +145,10 @@ CalendarManager *CalendarManager::instance(bool createIfNeeded)
 
 CalendarManager::~CalendarManager()
 {
+    foreach (QThread *thread, mReaderThreads) {
+        thread->quit();
+        thread->wait();
+    }
     mWorkerThread.quit();
     mWorkerThread.wait();
     if (managerInstance == this) {
@@ -167,7 +207,8 @@ void CalendarManager::saveModification(CalendarData::Event eventData, bool updat
                               Q_ARG(CalendarData::Event, eventData),
                               Q_ARG(bool, updateAttendees),
                               Q_ARG(QList<CalendarData::EmailContact>, required),
-                              Q_ARG(QList<CalendarData::EmailContact>, optional));
+                              Q_ARG(QList<CalendarData::EmailContact>, optional),
+                              Q_ARG(int, queueWrite()));
 }
 
 // caller owns returned object
@@ -197,7 +238,8 @@ CalendarManager::replaceOccurrence(CalendarData::Event eventData, CalendarEventO
                               Q_ARG(QDateTime, occurrence->startTime()),
                               Q_ARG(bool, updateAttendees),
                               Q_ARG(QList<CalendarData::EmailContact>, required),
-                              Q_ARG(QList<CalendarData::EmailContact>, optional));
+                              Q_ARG(QList<CalendarData::EmailContact>, optional),
+                              Q_ARG(int, queueWrite()));
     return changes;
 }
 
@@ -381,44 +423,213 @@ QList<CalendarData::Range> CalendarManager::addRanges(const QList<CalendarData::
 
 void CalendarManager::updateAgendaModel(CalendarAgendaModel *model)
 {
+    CalendarTraceSpan span("CalendarManager::updateAgendaModel");
     QList<CalendarEventOccurrence*> filtered;
-    if (model->startDate() == model->endDate() || !model->endDate().isValid()) {
-        foreach (const QString &id, mEventOccurrenceForDates.value(model->startDate())) {
-            if (mEventOccurrences.contains(id)) {
-                CalendarData::EventOccurrence eo = mEventOccurrences.value(id);
-                filtered.append(new CalendarEventOccurrence(eo.eventUid, eo.recurrenceId,
-                                                            eo.startTime, eo.endTime));
+    foreach (const CalendarData::EventOccurrence &eo, occurrencesInRange(model->startDate(), model->endDate())) {
+        filtered.append(new CalendarEventOccurrence(eo.eventUid, eo.recurrenceId,
+                                                    eo.startTime, eo.endTime));
+    }
+
+    span.setCount("occurrences", filtered.count());
+    model->doRefresh(filtered);
+}
+
+// Occurrences of the loaded data overlapping the range, unsorted.
+QList<CalendarData::EventOccurrence> CalendarManager::occurrencesInRange(const QDate &start, const QDate &end) const
+{
+    QList<CalendarData::EventOccurrence> filtered;
+    if (start == end || !end.isValid()) {
+        foreach (const QString &id, mEventOccurrenceForDates.value(start)) {
+            QHash<QString, CalendarData::EventOccurrence>::const_iterator it = mEventOccurrences.constFind(id);
+            if (it != mEventOccurrences.constEnd()) {
+                filtered.append(it.value());
             } else {
                 qWarning() << "no occurrence with id" << id;
             }
         }
     } else {
-        foreach (const CalendarData::EventOccurrence &eo, mEventOccurrences.values()) {
-            CalendarEvent *event = eventObject(eo.eventUid, eo.recurrenceId);
+        foreach (const CalendarData::EventOccurrence &eo, mEventOccurrences) {
+            const CalendarData::Event *event = findEvent(eo.eventUid, eo.recurrenceId);
             if (!event) {
                 qWarning() << "no event for occurrence";
                 continue;
             }
-            QDate start = model->startDate();
-            QDate end = model->endDate();
 
             // on all day events the end time is inclusive, otherwise not
             if ((eo.startTime.date() < start
                  && (eo.endTime.date() > start
-                     || (eo.endTime.date() == start && (event->allDay()
+                     || (eo.endTime.date() == start && (event->allDay
                                                         || eo.endTime.time() > QTime(0, 0)))))
                     || (eo.startTime.date() >= start && eo.startTime.date() <= end)) {
-                filtered.append(new CalendarEventOccurrence(eo.eventUid, eo.recurrenceId,
-                                                            eo.startTime, eo.endTime));
+                filtered.append(eo);
             }
         }
     }
+    return filtered;
+}
 
-    model->doRefresh(filtered);
+const CalendarData::Event *CalendarManager::findEvent(const QString &uid, const QDateTime &recurrenceId) const
+{
+    QMultiHash<QString, CalendarData::Event>::const_iterator it = mEvents.constFind(uid);
+    while (it != mEvents.constEnd() && it.key() == uid) {
+        if (it.value().recurrenceId == recurrenceId)
+            return &it.value();
+        ++it;
+    }
+    return 0;
+}
+
+// Same order as in CalendarAgendaModel
+static bool agendaItemLessThan(const CalendarManager::AgendaItem &item1, const CalendarManager::AgendaItem &item2)
+{
+    if (item1.first->startTime == item2.first->startTime) {
+        int cmp = QString::compare(item1.second->displayLabel, item2.second->displayLabel, Qt::CaseInsensitive);
+        if (cmp == 0)
+            return QString::compare(item1.second->uniqueId, item2.second->uniqueId) < 0;
+        else
+            return cmp < 0;
+    } else {
+        return item1.first->startTime < item2.first->startTime;
+    }
+}
+
+QList<CalendarManager::AgendaItem> CalendarManager::agenda(const QDate &start, const QDate &end) const
+{
+    CalendarTraceSpan span("CalendarManager::agenda");
+    QList<AgendaItem> items;
+
+    const QDate last = end.isValid() ? qMax(start, end) : start;
+    bool indexed = false;
+    foreach (const CalendarData::Range &range, mLoadedRanges) {
+        if (start >= range.first && last <= range.second) {
+            indexed = true;
+            break;
+        }
+    }
+
+    if (indexed) {
+        // Every day of a loaded range is in the daily index, occurrences
+        // covering several days are taken on the first one of the range.
+        for (QDate day = start; day <= last; day = day.addDays(1)) {
+            QHash<QDate, QStringList>::const_iterator ids = mEventOccurrenceForDates.constFind(day);
+            if (ids == mEventOccurrenceForDates.constEnd())
+                continue;
+            foreach (const QString &id, ids.value()) {
+                QHash<QString, CalendarData::EventOccurrence>::const_iterator it = mEventOccurrences.constFind(id);
+                if (it == mEventOccurrences.constEnd()) {
+                    qWarning() << "no occurrence with id" << id;
+                    continue;
+                }
+                if (day != start && it->startTime.date() < day)
+                    continue;
+                const CalendarData::Event *event = findEvent(it->eventUid, it->recurrenceId);
+                if (event)
+                    items.append(AgendaItem(&it.value(), event));
+            }
+        }
+    } else {
+        QHash<QString, CalendarData::EventOccurrence>::const_iterator it;
+        for (it = mEventOccurrences.constBegin(); it != mEventOccurrences.constEnd(); ++it) {
+            const CalendarData::EventOccurrence &eo = it.value();
+            const CalendarData::Event *event = findEvent(eo.eventUid, eo.recurrenceId);
+            if (!event)
+                continue;
+            // Same rule as occurrencesInRange().
+            if ((eo.startTime.date() < start
+                 && (eo.endTime.date() > start
+                     || (eo.endTime.date() == start && (event->allDay
+                                                        || eo.endTime.time() > QTime(0, 0)))))
+                    || (eo.startTime.date() >= start && eo.startTime.date() <= last)) {
+                items.append(AgendaItem(&eo, event));
+            }
+        }
+    }
+    qSort(items.begin(), items.end(), agendaItemLessThan);
+
+    span.setCount("occurrences", items.count());
+    return items;
+}
+
+static qint64 stringSize(const QString &string)
+{
+    return string.capacity() * sizeof(QChar);
+}
+
+// The estimate ignores the allocator and container overheads,
+// except for a few pointers per hash node.
+static qint64 eventSize(const CalendarData::Event &event)
+{
+    return sizeof(CalendarData::Event) + 3 * sizeof(void *)
+            + stringSize(event.displayLabel) + stringSize(event.description)
+            + stringSize(event.uniqueId) + stringSize(event.location)
+            + stringSize(event.calendarUid);
+}
+
+QVariantMap CalendarManager::statistics() const
+{
+    qint64 memoryUsage = 0;
+    foreach (const CalendarData::Event &event, mEvents)
+        memoryUsage += eventSize(event);
+    for (QHash<QString, CalendarData::EventOccurrence>::ConstIterator it = mEventOccurrences.constBegin();
+         it != mEventOccurrences.constEnd(); ++it) {
+        memoryUsage += sizeof(CalendarData::EventOccurrence) + 3 * sizeof(void *)
+                + stringSize(it.key()) + stringSize(it.value().eventUid);
+    }
+    for (QHash<QDate, QStringList>::ConstIterator it = mEventOccurrenceForDates.constBegin();
+         it != mEventOccurrenceForDates.constEnd(); ++it) {
+        memoryUsage += sizeof(QDate) + sizeof(QStringList) + 3 * sizeof(void *);
+        foreach (const QString &id, it.value())
+            memoryUsage += sizeof(void *) + stringSize(id);
+    }
+
+    QStringList loadedRanges;
+    foreach (const CalendarData::Range &range, mLoadedRanges) {
+        loadedRanges << range.first.toString(Qt::ISODate) + QLatin1Char('/')
+                        + range.second.toString(Qt::ISODate);
+    }
+
+    qint64 latencyAverage = 0;
+    qint64 latency95 = 0;
+    if (!mLoadLatencies.isEmpty()) {
+        QList<qint64> latencies = mLoadLatencies;
+        std::sort(latencies.begin(), latencies.end());
+        foreach (qint64 latency, latencies)
+            latencyAverage += latency;
+        latencyAverage /= latencies.count();
+        latency95 = latencies.at((latencies.count() * 95 + 99) / 100 - 1);
+    }
+
+    QVariantMap statistics;
+    statistics.insert(QStringLiteral("events"), mEvents.count());
+    statistics.insert(QStringLiteral("occurrences"), mEventOccurrences.count());
+    statistics.insert(QStringLiteral("days"), mEventOccurrenceForDates.count());
+    statistics.insert(QStringLiteral("eventObjects"), mEventObjects.count());
+    statistics.insert(QStringLiteral("loadedRanges"), loadedRanges);
+    statistics.insert(QStringLiteral("memoryUsage"), memoryUsage);
+    statistics.insert(QStringLiteral("loadPending"), mLoadPending);
+    statistics.insert(QStringLiteral("pendingRefreshes"), mAgendaRefreshList.count() + mQueryRefreshList.count());
+    statistics.insert(QStringLiteral("pendingOccurrenceExceptions"), mPendingOccurrenceExceptions.count());
+    statistics.insert(QStringLiteral("loads"), mLoadCount);
+    statistics.insert(QStringLiteral("resets"), mResetCount);
+    statistics.insert(QStringLiteral("loadLatencyAverage"), latencyAverage);
+    statistics.insert(QStringLiteral("loadLatency95"), latency95);
+    statistics.insert(QStringLiteral("rangeHits"), mRangeHitCount);
+    statistics.insert(QStringLiteral("rangeMisses"), mRangeMissCount);
+
+    // Invitation and import files, shared by all the users of the process.
+    const CalendarUtils::ParseCacheStatistics parseCache = CalendarUtils::parseCacheStatistics();
+    statistics.insert(QStringLiteral("parseCacheHits"), parseCache.hits);
+    statistics.insert(QStringLiteral("parseCacheMisses"), parseCache.misses);
+    statistics.insert(QStringLiteral("parseCacheEntries"), parseCache.entries);
+    return statistics;
 }
 
 void CalendarManager::doAgendaAndQueryRefresh()
 {
+    CalendarTraceSpan span("CalendarManager::doAgendaAndQueryRefresh");
+    span.setCount("models", mAgendaRefreshList.count());
+    span.setCount("queries", mQueryRefreshList.count());
+
     QList<CalendarAgendaModel *> agendaModels = mAgendaRefreshList;
     mAgendaRefreshList.clear();
     QList<CalendarData::Range> missingRanges;
@@ -434,10 +645,13 @@ void CalendarManager::doAgendaAndQueryRefresh()
         }
 
         QList<CalendarData::Range> newRanges;
-        if (isRangeLoaded(range, &newRanges))
+        if (isRangeLoaded(range, &newRanges)) {
+            mRangeHitCount++;
             updateAgendaModel(model);
-        else
+        } else {
+            mRangeMissCount++;
             missingRanges = addRanges(missingRanges, newRanges);
+        }
     }
 
     if (mResetPending) {
@@ -479,6 +693,10 @@ void CalendarManager::doAgendaAndQueryRefresh()
 
     if (!missingRanges.isEmpty() || !missingUidList.isEmpty()) {
         mLoadPending = true;
+        mLoadCount++;
+        if (mResetPending)
+            mResetCount++;
+        mLoadTimer.start();
         QMetaObject::invokeMethod(mCalendarWorker, "loadData", Qt::QueuedConnection,
                                   Q_ARG(QList<CalendarData::Range>, missingRanges),
                                   Q_ARG(QStringList, missingUidList),
@@ -529,6 +747,7 @@ void CalendarManager::occurrenceExceptionCreatedSlot(const CalendarData::Event &
 
 void CalendarManager::deleteEvent(const QString &uid, const QDateTime &recurrenceId, const QDateTime &time)
 {
+    queueWrite();
     QMetaObject::invokeMethod(mCalendarWorker, "deleteEvent", Qt::QueuedConnection,
                               Q_ARG(QString, uid),
                               Q_ARG(QDateTime, recurrenceId),
@@ -537,19 +756,39 @@ void CalendarManager::deleteEvent(const QString &uid, const QDateTime &recurrenc
 
 void CalendarManager::deleteAll(const QString &uid)
 {
+    queueWrite();
     QMetaObject::invokeMethod(mCalendarWorker, "deleteAll", Qt::QueuedConnection,
                               Q_ARG(QString, uid));
 }
 
 void CalendarManager::save()
 {
-    QMetaObject::invokeMethod(mCalendarWorker, "save", Qt::QueuedConnection);
+    QMetaObject::invokeMethod(mCalendarWorker, "save", Qt::QueuedConnection,
+                              Q_ARG(int, mQueuedWrites));
+}
+
+int CalendarManager::queueWrite()
+{
+    return ++mQueuedWrites;
+}
+
+void CalendarManager::savedSlot(int sequence)
+{
+    // The worker handles its queue in order, so every modification
+    // queued before the acknowledged one is saved as well.
+    mSavedWrites = sequence;
 }
 
 QString CalendarManager::convertEventToICalendarSync(const QString &uid, const QString &prodId)
 {
+    // Modifications not saved yet, or being saved, are only known to
+    // the worker. Otherwise a reader serves it without waiting on the
+    // worker queue.
+    QObject *target = mSavedWrites != mQueuedWrites
+            ? static_cast<QObject *>(mCalendarWorker)
+            : static_cast<QObject *>(nextReader());
     QString vEvent;
-    QMetaObject::invokeMethod(mCalendarWorker, "convertEventToICalendar", Qt::BlockingQueuedConnection,
+    QMetaObject::invokeMethod(target, "convertEventToICalendar", Qt::BlockingQueuedConnection,
                               Q_RETURN_ARG(QString, vEvent),
                               Q_ARG(QString, uid),
                               Q_ARG(QString, prodId));
@@ -579,11 +818,39 @@ bool CalendarManager::sendResponse(const CalendarData::Event &eventData, Calenda
     return result;
 }
 
-void CalendarManager::scheduleInvitationQuery(CalendarInvitationQuery *query, const QString &invitationFile)
+void CalendarManager::scheduleInvitationQuery(CalendarInvitationQuery *query,
+                                              const CalendarData::Invitation &invitation)
 {
-    mInvitationQueryHash.insert(query, invitationFile);
-    QMetaObject::invokeMethod(mCalendarWorker, "findMatchingEvent", Qt::QueuedConnection,
-                              Q_ARG(QString, invitationFile));
+    const QString key = invitation.key();
+    mInvitationQueryHash.insert(query, key);
+
+    // Queries issued together, e.g. when a mail folder is opened, are
+    // resolved by the reader in one go.
+    if (mPendingInvitationKeys.contains(key))
+        return;
+    mPendingInvitationKeys.insert(key);
+    mPendingInvitations.append(invitation);
+    if (!mInvitationTimer->isActive())
+        mInvitationTimer->start();
+}
+
+void CalendarManager::sendInvitationQueries()
+{
+    if (mPendingInvitations.isEmpty())
+        return;
+
+    QMetaObject::invokeMethod(nextReader(), "findMatchingEvents", Qt::QueuedConnection,
+                              Q_ARG(QList<CalendarData::Invitation>, mPendingInvitations));
+    mPendingInvitations.clear();
+    mPendingInvitationKeys.clear();
+}
+
+CalendarReader *CalendarManager::nextReader()
+{
+    // Simple round robin, queries are short lived and of similar cost.
+    CalendarReader *reader = mCalendarReaders.at(mNextReader);
+    mNextReader = (mNextReader + 1) % mCalendarReaders.count();
+    return reader;
 }
 
 void CalendarManager::unRegisterInvitationQuery(CalendarInvitationQuery *query)
@@ -591,11 +858,11 @@ void CalendarManager::unRegisterInvitationQuery(CalendarInvitationQuery *query)
     mInvitationQueryHash.remove(query);
 }
 
-void CalendarManager::findMatchingEventFinished(const QString &invitationFile, const CalendarData::Event &event)
+void CalendarManager::findMatchingEventFinished(const QString &invitation, const CalendarData::Event &event)
 {
     QHash<CalendarInvitationQuery*, QString>::iterator it = mInvitationQueryHash.begin();
     while (it != mInvitationQueryHash.end()) {
-        if (it.value() == invitationFile) {
+        if (it.value() == invitation) {
             it.key()->queryResult(event);
             it = mInvitationQueryHash.erase(it);
         } else {
@@ -742,6 +1009,10 @@ void CalendarManager::dataLoadedSlot(const QList<CalendarData::Range> &ranges,
                                      const QHash<QDate, QStringList> &dailyOccurrences,
                                      bool reset)
 {
+    CalendarTraceSpan span("CalendarManager::dataLoadedSlot");
+    span.setCount("events", events.count());
+    span.setCount("occurrences", occurrences.count());
+
     QList<CalendarData::Event> oldEvents;
     foreach (const QString &uid, mEventObjects.keys()) {
         // just add all matching uid, change signal emission will match recurrence ids
@@ -761,6 +1032,12 @@ void CalendarManager::dataLoadedSlot(const QList<CalendarData::Range> &ranges,
     mEventOccurrences = mEventOccurrences.unite(occurrences);
     mEventOccurrenceForDates = mEventOccurrenceForDates.unite(dailyOccurrences);
     mLoadPending = false;
+    if (mLoadTimer.isValid()) {
+        if (mLoadLatencies.count() == MaxLoadLatencyCount)
+            mLoadLatencies.removeFirst();
+        mLoadLatencies.append(mLoadTimer.elapsed());
+        mLoadTimer.invalidate();
+    }
 
     foreach (const CalendarData::Event &oldEvent, oldEvents) {
         CalendarData::Event event = getEvent(oldEvent.uniqueId, oldEvent.recurrenceId);
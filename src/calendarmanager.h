@@ -39,12 +39,16 @@
 #include <QTimer>
 #include <QPointer>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QVariantMap>
+#include <QSet>
 
 #include "calendardata.h"
 #include "calendarevent.h"
 #include "calendarchangeinformation.h"
 
 class CalendarWorker;
+class CalendarReader;
 class CalendarAgendaModel;
 class CalendarEventOccurrence;
 class CalendarEventQuery;
@@ -100,7 +104,7 @@ public:
     void cancelEventQueryRefresh(CalendarEventQuery *query);
 
     // Invitation event search
-    void scheduleInvitationQuery(CalendarInvitationQuery *query, const QString &invitationFile);
+    void scheduleInvitationQuery(CalendarInvitationQuery *query, const CalendarData::Invitation &invitation);
     void unRegisterInvitationQuery(CalendarInvitationQuery *query);
 
     // Caller gets ownership of returned CalendarEventOccurrence object
@@ -110,6 +114,17 @@ public:
     // return attendees for given event, synchronous call
     QList<CalendarData::Attendee> getEventAttendees(const QString &uid, const QDateTime &recurrenceId, bool *resultValid);
 
+    // Counters and sizes of the cached data, see CalendarApi::statistics()
+    QVariantMap statistics() const;
+
+    // The occurrences an agenda model of the range shows, in the same order,
+    // with their events. Read from the loaded data without creating the
+    // QObject wrappers or copying it, for bulk readers like the data service.
+    // The pointers are valid until the data changes, i.e. until returning
+    // to the event loop.
+    typedef QPair<const CalendarData::EventOccurrence *, const CalendarData::Event *> AgendaItem;
+    QList<AgendaItem> agenda(const QDate &start, const QDate &end) const;
+
 private slots:
     void storageModifiedSlot(const QString &info);
     void eventNotebookChanged(const QString &oldEventUid, const QString &newEventUid, const QString &notebookUid);
@@ -125,8 +140,10 @@ private slots:
     void occurrenceExceptionFailedSlot(const CalendarData::Event &data, const QDateTime &occurrence);
     void occurrenceExceptionCreatedSlot(const CalendarData::Event &data, const QDateTime &occurrence,
                                         const QDateTime &newRecurrenceId);
-    void findMatchingEventFinished(const QString &invitationFile,
+    void findMatchingEventFinished(const QString &invitation,
                                    const CalendarData::Event &event);
+    void sendInvitationQueries();
+    void savedSlot(int sequence);
 
 signals:
     void excludedNotebooksChanged(QStringList excludedNotebooks);
@@ -140,24 +157,40 @@ signals:
 
 private:
     friend class tst_CalendarManager;
+    friend class bench_Calendar;
 
     void doAgendaAndQueryRefresh();
     bool isRangeLoaded(const QPair<QDate, QDate> &r, QList<CalendarData::Range> *newRanges);
     QList<CalendarData::Range> addRanges(const QList<CalendarData::Range> &oldRanges,
                                          const QList<CalendarData::Range> &newRanges);
     void updateAgendaModel(CalendarAgendaModel *model);
+    QList<CalendarData::EventOccurrence> occurrencesInRange(const QDate &start, const QDate &end) const;
+    const CalendarData::Event *findEvent(const QString &uid, const QDateTime &recurrenceId) const;
     void sendEventChangeSignals(const CalendarData::Event &newEvent,
                                 const CalendarData::Event &oldEvent);
+    CalendarReader *nextReader();
+    int queueWrite();
 
     QThread mWorkerThread;
     CalendarWorker *mCalendarWorker;
+    // Read-only storage connections, each living in its own thread,
+    // used for queries which don't need to wait for the worker.
+    QList<QThread *> mReaderThreads;
+    QList<CalendarReader *> mCalendarReaders;
+    int mNextReader;
+    // Sequence numbers of the last modification queued to the worker and
+    // of the last one acknowledged as saved. The readers only see the saved ones.
+    int mQueuedWrites;
+    int mSavedWrites;
     QMultiHash<QString, CalendarData::Event> mEvents;
     QMultiHash<QString, CalendarEvent *> mEventObjects;
     QHash<QString, CalendarData::EventOccurrence> mEventOccurrences;
     QHash<QDate, QStringList> mEventOccurrenceForDates;
     QList<CalendarAgendaModel *> mAgendaRefreshList;
     QList<CalendarEventQuery *> mQueryRefreshList;
-    QHash<CalendarInvitationQuery *, QString> mInvitationQueryHash; // value is the invitationFile.
+    QHash<CalendarInvitationQuery *, QString> mInvitationQueryHash; // value is the invitation key.
+    QList<CalendarData::Invitation> mPendingInvitations;
+    QSet<QString> mPendingInvitationKeys;
     QStringList mExcludedNotebooks;
     QHash<QString, CalendarData::Notebook> mNotebooks;
 
@@ -169,6 +202,7 @@ private:
     QList<OccurrenceData> mPendingOccurrenceExceptions;
 
     QTimer *mTimer;
+    QTimer *mInvitationTimer;
 
     // If true indicates that CalendarWorker::loadRanges(...) has been called, and the response
     // has not been received in slot CalendarManager::rangesLoaded(...)
@@ -183,6 +217,14 @@ private:
     // A list of event UIDs that have been processed by CalendarWorker, any events that
     // match the UIDs have been loaded
     QStringList mLoadedQueries;
+
+    // Statistics
+    int mLoadCount;
+    int mResetCount;
+    int mRangeHitCount;
+    int mRangeMissCount;
+    QElapsedTimer mLoadTimer;
+    QList<qint64> mLoadLatencies; // in ms, the most recent ones
 };
 
 #endif // CALENDARMANAGER_H
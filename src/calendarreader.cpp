@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "calendarreader.h"
+#include "calendarutils.h"
+
+#include <QDebug>
+#include <QStringList>
+#include <QSet>
+#include <QtConcurrent>
+
+// KCalendarCore
+#include <KCalendarCore/ICalFormat>
+#include <KCalendarCore/MemoryCalendar>
+
+namespace {
+    QStringList indexKeys(const KCalendarCore::Incidence::Ptr &incidence)
+    {
+        QStringList keys;
+        keys << incidence->uid().toCaseFolded();
+        const QString remoteUid = incidence->nonKDECustomProperty("X-SAILFISHOS-REMOTE-UID").toCaseFolded();
+        if (!remoteUid.isEmpty() && remoteUid != keys.first()) {
+            keys << remoteUid;
+        }
+        return keys;
+    }
+
+    // Returns the first event of the invitation, it should only contain one.
+    KCalendarCore::Incidence::Ptr parseInvitation(const CalendarData::Invitation &invitation)
+    {
+        KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::systemTimeZone()));
+        if (invitation.file.isEmpty()) {
+            CalendarUtils::importFromIcsRawData(invitation.icsData, cal);
+        } else {
+            CalendarUtils::importFromFile(invitation.file, cal);
+        }
+        const KCalendarCore::Incidence::List incidenceList = cal->incidences();
+        for (const KCalendarCore::Incidence::Ptr &incidence : incidenceList) {
+            if (incidence->type() == KCalendarCore::IncidenceBase::TypeEvent) {
+                return incidence;
+            }
+        }
+        return KCalendarCore::Incidence::Ptr();
+    }
+
+    // Merges the +/- 1 day windows around the given dates into sorted,
+    // non-overlapping ranges.
+    QList<CalendarData::Range> invitationRanges(QList<QDate> dates)
+    {
+        std::sort(dates.begin(), dates.end());
+        QList<CalendarData::Range> ranges;
+        for (const QDate &date : dates) {
+            if (!ranges.isEmpty() && ranges.last().second.addDays(1) >= date.addDays(-1)) {
+                ranges.last().second = date.addDays(1);
+            } else {
+                ranges.append(CalendarData::Range(date.addDays(-1), date.addDays(1)));
+            }
+        }
+        return ranges;
+    }
+}
+
+CalendarReader::CalendarReader()
+    : QObject(0)
+{
+}
+
+CalendarReader::~CalendarReader()
+{
+    if (mCalendar.data()) {
+        mCalendar->unregisterObserver(this);
+    }
+    if (mStorage.data()) {
+        mStorage->unregisterObserver(this);
+        mStorage->close();
+    }
+
+    mCalendar.clear();
+    mStorage.clear();
+}
+
+void CalendarReader::storageModified(mKCal::ExtendedStorage *storage, const QString &info)
+{
+    Q_UNUSED(storage)
+    Q_UNUSED(info)
+
+    // Readers never modify the database, so any change comes from
+    // the writer or from another process. Drop everything loaded so far,
+    // next queries will read the new state from the storage.
+    // Calendar observers are not notified on close().
+    mCalendar->close();
+    mUidIndex.clear();
+}
+
+void CalendarReader::storageProgress(mKCal::ExtendedStorage *storage, const QString &info)
+{
+    Q_UNUSED(storage)
+    Q_UNUSED(info)
+}
+
+void CalendarReader::storageFinished(mKCal::ExtendedStorage *storage, bool error, const QString &info)
+{
+    Q_UNUSED(storage)
+    Q_UNUSED(error)
+    Q_UNUSED(info)
+}
+
+void CalendarReader::calendarIncidenceAdded(const KCalendarCore::Incidence::Ptr &incidence)
+{
+    for (const QString &key : indexKeys(incidence)) {
+        mUidIndex.insert(key, incidence);
+    }
+}
+
+void CalendarReader::calendarIncidenceChanged(const KCalendarCore::Incidence::Ptr &incidence)
+{
+    // The remote UID may have changed, drop any previous entry.
+    QMultiHash<QString, KCalendarCore::Incidence::Ptr>::iterator it = mUidIndex.begin();
+    while (it != mUidIndex.end()) {
+        if (it.value() == incidence) {
+            it = mUidIndex.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    calendarIncidenceAdded(incidence);
+}
+
+void CalendarReader::calendarIncidenceDeleted(const KCalendarCore::Incidence::Ptr &incidence,
+                                              const KCalendarCore::Calendar *calendar)
+{
+    Q_UNUSED(calendar)
+
+    for (const QString &key : indexKeys(incidence)) {
+        mUidIndex.remove(key, incidence);
+    }
+}
+
+void CalendarReader::init()
+{
+    mCalendar = mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(QTimeZone::systemTimeZone()));
+    mCalendar->registerObserver(this);
+    mStorage = mCalendar->defaultStorage(mCalendar);
+    if (!mStorage->open()) {
+        qWarning() << "CalendarReader: unable to open calendar DB";
+        return;
+    }
+    mStorage->registerObserver(this);
+}
+
+QString CalendarReader::convertEventToICalendar(const QString &uid, const QString &prodId)
+{
+    // The storage notification of a save may not have reached this
+    // thread yet, read the series again from the storage. The removal
+    // is only in memory, readers never save.
+    KCalendarCore::Event::Ptr event = mCalendar->event(uid);
+    if (event) {
+        mCalendar->deleteEventInstances(event);
+        mCalendar->deleteEvent(event);
+        event.clear();
+    }
+
+    // NOTE: not fetching eventInstances() with different recurrenceId
+    if (mStorage->load(uid)) {
+        event = mCalendar->event(uid);
+    }
+    if (event.isNull()) {
+        qWarning() << "No event with uid " << uid << ", unable to create iCalendar";
+        return QString();
+    }
+
+    KCalendarCore::ICalFormat fmt;
+    fmt.setApplication(fmt.application(),
+                       prodId.isEmpty() ? QLatin1String("-//sailfishos.org/Sailfish//NONSGML v1.0//EN") : prodId);
+    return fmt.toICalString(event);
+}
+
+CalendarData::Event CalendarReader::createEventStruct(const KCalendarCore::Event::Ptr &event) const
+{
+    CalendarData::Event eventData = CalendarUtils::convertEvent(event);
+    eventData.calendarUid = mCalendar->notebook(event);
+    mKCal::Notebook::Ptr notebook = mStorage->notebook(eventData.calendarUid);
+    eventData.readOnly = notebook.isNull() || notebook->isReadOnly();
+    return eventData;
+}
+
+KCalendarCore::Incidence::Ptr CalendarReader::matchingIncidence(const KCalendarCore::Incidence::Ptr &invitation) const
+{
+    const QList<KCalendarCore::Incidence::Ptr> candidates = mUidIndex.values(invitation->uid().toCaseFolded());
+    for (const KCalendarCore::Incidence::Ptr &dbIncidence : candidates) {
+        if (dbIncidence->type() != KCalendarCore::IncidenceBase::TypeEvent) {
+            continue;
+        }
+        if ((!invitation->hasRecurrenceId() && !dbIncidence->hasRecurrenceId())
+                || (invitation->hasRecurrenceId() && dbIncidence->hasRecurrenceId()
+                    && invitation->recurrenceId() == dbIncidence->recurrenceId())) {
+            return dbIncidence;
+        }
+    }
+    return KCalendarCore::Incidence::Ptr();
+}
+
+void CalendarReader::reportMatch(const QString &invitation, const KCalendarCore::Incidence::Ptr &dbIncidence)
+{
+    emit findMatchingEventFinished(invitation, dbIncidence
+                                   ? createEventStruct(dbIncidence.staticCast<KCalendarCore::Event>())
+                                   : CalendarData::Event());
+}
+
+void CalendarReader::findMatchingEvents(const QList<CalendarData::Invitation> &invitations)
+{
+    // Parsing doesn't touch the storage, spread it over the global thread pool.
+    const QList<KCalendarCore::Incidence::Ptr> incidences =
+            QtConcurrent::blockingMapped<QList<KCalendarCore::Incidence::Ptr> >(invitations, parseInvitation);
+
+    // Search for the events among the already loaded ones first,
+    // then try direct loads by UID, and only as a last resort,
+    // for UIDs differing in case or remote UIDs, load the
+    // incidences around the invitation dates, all at once.
+    QList<int> pending;
+    for (int i = 0; i < invitations.count(); ++i) {
+        const KCalendarCore::Incidence::Ptr &incidence = incidences.at(i);
+        if (!incidence) {
+            reportMatch(invitations.at(i).key(), KCalendarCore::Incidence::Ptr());
+            continue;
+        }
+        const KCalendarCore::Incidence::Ptr dbIncidence = matchingIncidence(incidence);
+        if (dbIncidence) {
+            reportMatch(invitations.at(i).key(), dbIncidence);
+        } else {
+            pending.append(i);
+        }
+    }
+
+    QList<int> missing;
+    QSet<QString> loadedUids;
+    for (int i : pending) {
+        const KCalendarCore::Incidence::Ptr &incidence = incidences.at(i);
+        if (!loadedUids.contains(incidence->uid())) {
+            loadedUids.insert(incidence->uid());
+            mStorage->loadSeries(incidence->uid());
+        }
+        const KCalendarCore::Incidence::Ptr dbIncidence = matchingIncidence(incidence);
+        if (dbIncidence) {
+            reportMatch(invitations.at(i).key(), dbIncidence);
+        } else {
+            missing.append(i);
+        }
+    }
+
+    if (missing.isEmpty()) {
+        return;
+    }
+
+    QList<QDate> dates;
+    for (int i : missing) {
+        dates.append(incidences.at(i)->dtStart().date());
+    }
+    for (const CalendarData::Range &range : invitationRanges(dates)) {
+        mStorage->load(range.first, range.second.addDays(1)); // end date is not inclusive
+    }
+    mStorage->loadRecurringIncidences();
+
+    for (int i : missing) {
+        reportMatch(invitations.at(i).key(), matchingIncidence(incidences.at(i)));
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef CALENDARREADER_H
+#define CALENDARREADER_H
+
+#include "calendardata.h"
+
+#include <QObject>
+#include <QMultiHash>
+
+// mkcal
+#include <extendedstorage.h>
+
+// KCalendarCore
+#include <KCalendarCore/Calendar>
+
+// A read-only connection to the calendar database. Several of them
+// can live next to the CalendarWorker, each on its own thread, to
+// serve queries which don't need to go through the writer queue.
+// The loaded incidences are dropped whenever the storage reports a
+// modification, so that a reader never serves data older than the
+// last storage notification.
+class CalendarReader : public QObject, public mKCal::ExtendedStorageObserver,
+                       public KCalendarCore::Calendar::CalendarObserver
+{
+    Q_OBJECT
+
+public:
+    CalendarReader();
+    ~CalendarReader();
+
+    /* mKCal::ExtendedStorageObserver */
+    void storageModified(mKCal::ExtendedStorage *storage, const QString &info);
+    void storageProgress(mKCal::ExtendedStorage *storage, const QString &info);
+    void storageFinished(mKCal::ExtendedStorage *storage, bool error, const QString &info);
+
+    /* KCalendarCore::Calendar::CalendarObserver */
+    void calendarIncidenceAdded(const KCalendarCore::Incidence::Ptr &incidence);
+    void calendarIncidenceChanged(const KCalendarCore::Incidence::Ptr &incidence);
+    void calendarIncidenceDeleted(const KCalendarCore::Incidence::Ptr &incidence,
+                                  const KCalendarCore::Calendar *calendar);
+
+public slots:
+    void init();
+
+    QString convertEventToICalendar(const QString &uid, const QString &prodId);
+    void findMatchingEvents(const QList<CalendarData::Invitation> &invitations);
+
+signals:
+    void findMatchingEventFinished(const QString &invitation,
+                                   const CalendarData::Event &eventData);
+
+private:
+    CalendarData::Event createEventStruct(const KCalendarCore::Event::Ptr &event) const;
+    KCalendarCore::Incidence::Ptr matchingIncidence(const KCalendarCore::Incidence::Ptr &invitation) const;
+    void reportMatch(const QString &invitation, const KCalendarCore::Incidence::Ptr &dbIncidence);
+
+    mKCal::ExtendedCalendar::Ptr mCalendar;
+    mKCal::ExtendedStorage::Ptr mStorage;
+
+    // Loaded incidences, by case folded UID and case folded
+    // X-SAILFISHOS-REMOTE-UID, kept up to date through the
+    // calendar observer while incidences get loaded.
+    QMultiHash<QString, KCalendarCore::Incidence::Ptr> mUidIndex;
+};
+
+#endif // CALENDARREADER_H
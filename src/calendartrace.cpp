@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include "calendartrace.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+#include <QCoreApplication>
+#include <QDebug>
+
+Q_LOGGING_CATEGORY(lcCalendarTrace, "org.nemomobile.calendar.trace", QtWarningMsg)
+
+namespace {
+
+class TraceFile
+{
+public:
+    TraceFile()
+    {
+        mClock.start();
+        const QString fileName = QString::fromLocal8Bit(qgetenv("NEMO_CALENDAR_TRACE_FILE"));
+        if (fileName.isEmpty())
+            return;
+
+        mFile.setFileName(fileName);
+        // The closing bracket can be omitted, so that the trace stays
+        // readable even when the process doesn't exit cleanly.
+        if (!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)
+                || mFile.write("[\n") < 0) {
+            qWarning() << "Cannot write calendar trace to" << fileName << mFile.errorString();
+            mFile.close();
+        }
+    }
+
+    bool isOpen() const
+    {
+        return mFile.isOpen();
+    }
+
+    qint64 now() const
+    {
+        return mClock.nsecsElapsed() / 1000;
+    }
+
+    void write(const char *name, qint64 start, qint64 duration,
+               const QVector<QPair<const char *, int> > &counts)
+    {
+        QByteArray event = "{\"name\":\"" + QByteArray(name)
+                + "\",\"ph\":\"X\",\"ts\":" + QByteArray::number(start)
+                + ",\"dur\":" + QByteArray::number(duration)
+                + ",\"pid\":" + QByteArray::number(QCoreApplication::applicationPid())
+                + ",\"tid\":" + QByteArray::number(quintptr(QThread::currentThreadId()));
+        if (!counts.isEmpty()) {
+            event += ",\"args\":{";
+            for (int i = 0; i < counts.count(); ++i) {
+                if (i > 0)
+                    event += ',';
+                event += '"' + QByteArray(counts.at(i).first) + "\":" + QByteArray::number(counts.at(i).second);
+            }
+            event += '}';
+        }
+        event += "},\n";
+
+        QMutexLocker locker(&mMutex);
+        mFile.write(event);
+        mFile.flush();
+    }
+
+private:
+    QElapsedTimer mClock;
+    QMutex mMutex;
+    QFile mFile;
+};
+
+Q_GLOBAL_STATIC(TraceFile, traceFile)
+
+}
+
+CalendarTraceSpan::CalendarTraceSpan(const char *name)
+    : mName(name)
+    , mStart(-1)
+{
+    if (lcCalendarTrace().isDebugEnabled() || traceFile()->isOpen())
+        mStart = traceFile()->now();
+}
+
+CalendarTraceSpan::~CalendarTraceSpan()
+{
+    if (mStart < 0)
+        return;
+
+    const qint64 duration = traceFile()->now() - mStart;
+    if (lcCalendarTrace().isDebugEnabled()) {
+        QString message = QString::fromLatin1("%1: %2 ms").arg(QLatin1String(mName)).arg(duration / 1000.);
+        for (int i = 0; i < mCounts.count(); ++i)
+            message += QString::fromLatin1(", %1: %2").arg(QLatin1String(mCounts.at(i).first)).arg(mCounts.at(i).second);
+        qCDebug(lcCalendarTrace).noquote() << message;
+    }
+    if (traceFile()->isOpen())
+        traceFile()->write(mName, mStart, duration, mCounts);
+}
+
+void CalendarTraceSpan::setCount(const char *key, int count)
+{
+    if (mStart >= 0)
+        mCounts.append(qMakePair(key, count));
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#ifndef CALENDARTRACE_H
+#define CALENDARTRACE_H
+
+#include <QLoggingCategory>
+#include <QVector>
+#include <QPair>
+
+Q_DECLARE_LOGGING_CATEGORY(lcCalendarTrace)
+
+// Measures the time spent in its scope. Spans are logged in the
+// org.nemomobile.calendar.trace category, e.g. with
+// QT_LOGGING_RULES="org.nemomobile.calendar.trace.debug=true", and
+// written in the Chrome trace event format to the file named by
+// NEMO_CALENDAR_TRACE_FILE when it is set. When neither is enabled,
+// a span costs a couple of checks.
+class CalendarTraceSpan
+{
+public:
+    explicit CalendarTraceSpan(const char *name);
+    ~CalendarTraceSpan();
+
+    // Attaches a count, like the number of processed events, to the span.
+    void setCount(const char *key, int count);
+
+private:
+    Q_DISABLE_COPY(CalendarTraceSpan)
+
+    const char *mName;
+    qint64 mStart;
+    QVector<QPair<const char *, int> > mCounts;
+};
+
+#endif // CALENDARTRACE_H
@@ -37,18 +37,67 @@
 // kcalendarcore
 #include <KCalendarCore/ICalFormat>
 #include <KCalendarCore/VCalFormat>
+#include <KCalendarCore/MemoryCalendar>
 
 //mkcal
 #include <servicehandler.h>
 
 // Qt
 #include <QFile>
+#include <QFileInfo>
 #include <QUrl>
 #include <QString>
 #include <QBitArray>
 #include <QByteArray>
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QtDebug>
 
+namespace {
+    // Parsed invitation and import files, keyed by canonical path, size and
+    // modification time, so that a rewritten file is never served stale.
+    // The cost of an entry is the file size in bytes.
+    const int ParseCacheMaxCost = 2 * 1024 * 1024;
+
+    struct ParseCache {
+        ParseCache() : files(ParseCacheMaxCost), hits(0), misses(0) {}
+
+        QMutex mutex;
+        QCache<QString, KCalendarCore::MemoryCalendar::Ptr> files;
+        quint64 hits;
+        quint64 misses;
+    };
+    Q_GLOBAL_STATIC(ParseCache, parseCache)
+
+    QString parseCacheKey(const QFileInfo &info)
+    {
+        return QString::fromLatin1("%1:%2:%3").arg(info.canonicalFilePath())
+                .arg(info.size())
+                .arg(info.lastModified().toMSecsSinceEpoch());
+    }
+
+    // Callers modify the imported incidences, so hand out copies. The
+    // calendar level properties are kept, as parsing into the given
+    // calendar would.
+    void addParsed(KCalendarCore::Calendar::Ptr calendar, const KCalendarCore::MemoryCalendar::Ptr &parsed)
+    {
+        if (!parsed->productId().isEmpty())
+            calendar->setProductId(parsed->productId());
+        QMap<QByteArray, QString> properties = calendar->customProperties();
+        const QMap<QByteArray, QString> parsedProperties = parsed->customProperties();
+        for (QMap<QByteArray, QString>::ConstIterator it = parsedProperties.constBegin();
+             it != parsedProperties.constEnd(); ++it) {
+            properties.insert(it.key(), it.value());
+        }
+        calendar->setCustomProperties(properties);
+
+        for (const KCalendarCore::Incidence::Ptr &incidence : parsed->rawIncidences()) {
+            calendar->addIncidence(KCalendarCore::Incidence::Ptr(incidence->clone()));
+        }
+    }
+}
+
 CalendarEvent::Recur CalendarUtils::convertRecurrence(const KCalendarCore::Event::Ptr &event)
 {
     if (!event->recurs())
@@ -132,6 +181,43 @@ CalendarEvent::Secrecy CalendarUtils::convertSecrecy(const KCalendarCore::Event:
     }
 }
 
+// Fills the event data which only depends on the incidence itself,
+// notebook related fields (calendarUid, readOnly, invitation and
+// owner status) are left to the caller.
+CalendarData::Event CalendarUtils::convertEvent(const KCalendarCore::Event::Ptr &e)
+{
+    CalendarData::Event event;
+    event.uniqueId = e->uid();
+    event.recurrenceId = e->recurrenceId();
+    event.allDay = e->allDay();
+    event.description = e->description();
+    event.displayLabel = e->summary();
+    event.endTime = e->dtEnd();
+    event.location = e->location();
+    event.secrecy = convertSecrecy(e);
+    event.recur = convertRecurrence(e);
+    event.recurWeeklyDays = convertDayPositions(e);
+    const QString &syncFailure = e->customProperty("VOLATILE", "SYNC-FAILURE");
+    if (syncFailure.compare("upload", Qt::CaseInsensitive) == 0) {
+        event.syncFailure = CalendarEvent::UploadFailure;
+    } else if (syncFailure.compare("update", Qt::CaseInsensitive) == 0) {
+        event.syncFailure = CalendarEvent::UpdateFailure;
+    } else if (syncFailure.compare("delete", Qt::CaseInsensitive) == 0) {
+        event.syncFailure = CalendarEvent::DeleteFailure;
+    }
+    // This defaults to QString() -> ResponseUnspecified in case the property is undefined
+    event.ownerStatus = convertResponseType(e->nonKDECustomProperty("X-EAS-RESPONSE-TYPE"));
+
+    KCalendarCore::RecurrenceRule *defaultRule = e->recurrence()->defaultRRule();
+    if (defaultRule) {
+        event.recurEndDate = defaultRule->endDt().date();
+    }
+    event.reminder = getReminder(e);
+    event.reminderDateTime = getReminderDateTime(e);
+    event.startTime = e->dtStart();
+    return event;
+}
+
 int CalendarUtils::getReminder(const KCalendarCore::Event::Ptr &event)
 {
     KCalendarCore::Alarm::List alarms = event->alarms();
@@ -295,6 +381,23 @@ bool CalendarUtils::importFromFile(const QString &fileName,
         return false;
     }
 
+    const QFileInfo info(filePath);
+    if (!info.exists()) {
+        qWarning() << "Unable to open file for reading" << filePath;
+        return false;
+    }
+    const QString cacheKey = parseCacheKey(info);
+    {
+        QMutexLocker locker(&parseCache()->mutex);
+        const KCalendarCore::MemoryCalendar::Ptr *cached = parseCache()->files.object(cacheKey);
+        if (cached) {
+            parseCache()->hits++;
+            addParsed(calendar, *cached);
+            return true;
+        }
+        parseCache()->misses++;
+    }
+
     QFile file(filePath);
     if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
         qWarning() << "Unable to open file for reading" << filePath;
@@ -302,18 +405,41 @@ bool CalendarUtils::importFromFile(const QString &fileName,
     }
     QByteArray fileContent(file.readAll());
 
+    // Parse into a calendar of our own, the given one may already
+    // contain incidences which don't belong to this file. It is kept
+    // as is in the cache.
+    KCalendarCore::MemoryCalendar::Ptr parsed(new KCalendarCore::MemoryCalendar(calendar->timeZone()));
     bool ok = false;
     if (filePath.endsWith(".vcs")) {
         KCalendarCore::VCalFormat vcalFormat;
-        ok = vcalFormat.fromRawString(calendar, fileContent);
+        ok = vcalFormat.fromRawString(parsed, fileContent);
     } else if (filePath.endsWith(".ics")) {
         KCalendarCore::ICalFormat icalFormat;
-        ok = icalFormat.fromRawString(calendar, fileContent);
+        ok = icalFormat.fromRawString(parsed, fileContent);
     }
-    if (!ok)
+    if (!ok) {
         qWarning() << "Failed to import from file" << filePath;
+        return false;
+    }
 
-    return ok;
+    addParsed(calendar, parsed);
+    {
+        QMutexLocker locker(&parseCache()->mutex);
+        parseCache()->files.insert(cacheKey, new KCalendarCore::MemoryCalendar::Ptr(parsed),
+                                   qMax(1, fileContent.size()));
+    }
+
+    return true;
+}
+
+CalendarUtils::ParseCacheStatistics CalendarUtils::parseCacheStatistics()
+{
+    QMutexLocker locker(&parseCache()->mutex);
+    ParseCacheStatistics statistics;
+    statistics.hits = parseCache()->hits;
+    statistics.misses = parseCache()->misses;
+    statistics.entries = parseCache()->files.count();
+    return statistics;
 }
 
 bool CalendarUtils::importFromIcsRawData(const QByteArray &icsData,
@@ -44,9 +44,16 @@
 
 namespace CalendarUtils {
 
+struct ParseCacheStatistics {
+    quint64 hits;
+    quint64 misses;
+    int entries;
+};
+
 CalendarEvent::Recur convertRecurrence(const KCalendarCore::Event::Ptr &event);
 CalendarEvent::Days convertDayPositions(const KCalendarCore::Event::Ptr &event);
 CalendarEvent::Secrecy convertSecrecy(const KCalendarCore::Event::Ptr &event);
+CalendarData::Event convertEvent(const KCalendarCore::Event::Ptr &event);
 int getReminder(const KCalendarCore::Event::Ptr &event);
 QDateTime getReminderDateTime(const KCalendarCore::Event::Ptr &event);
 QList<CalendarData::Attendee> getEventAttendees(const KCalendarCore::Event::Ptr &event);
@@ -54,6 +61,7 @@ QList<QObject*> convertAttendeeList(const QList<CalendarData::Attendee> &list);
 CalendarData::EventOccurrence getNextOccurrence(const KCalendarCore::Event::Ptr &event,
                                                 const QDateTime &start = QDateTime::currentDateTime());
 bool importFromFile(const QString &fileName, KCalendarCore::Calendar::Ptr calendar);
+ParseCacheStatistics parseCacheStatistics();
 bool importFromIcsRawData(const QByteArray &icsData, KCalendarCore::Calendar::Ptr calendar);
 CalendarEvent::Response convertPartStat(KCalendarCore::Attendee::PartStat status);
 KCalendarCore::Attendee::PartStat convertResponse(CalendarEvent::Response response);
@@ -32,6 +32,7 @@
 
 #include "calendarworker.h"
 #include "calendarutils.h"
+#include "calendartrace.h"
 
 #include <QDebug>
 #include <QSettings>
@@ -48,7 +49,6 @@
 #include <KCalendarCore/ICalFormat>
 #include <KCalendarCore/Recurrence>
 #include <KCalendarCore/RecurrenceRule>
-#include <KCalendarCore/MemoryCalendar>
 
 // libaccounts-qt
 #include <Accounts/Manager>
@@ -174,22 +174,13 @@ bool CalendarWorker::sendResponse(const CalendarData::Event &eventData, const Ca
     return mKCal::ServiceHandler::instance().sendResponse(event, eventData.description, mCalendar, mStorage);
 }
 
-QString CalendarWorker::convertEventToICalendar(const QString &uid, const QString &prodId) const
+void CalendarWorker::save(int sequence)
 {
-    // NOTE: not fetching eventInstances() with different recurrenceId
-    KCalendarCore::Event::Ptr event = mCalendar->event(uid);
-    if (event.isNull()) {
-        qWarning() << "No event with uid " << uid << ", unable to create iCalendar";
-        return QString();
-    }
-
-    KCalendarCore::ICalFormat fmt;
-    fmt.setApplication(fmt.application(),
-                       prodId.isEmpty() ? QLatin1String("-//sailfishos.org/Sailfish//NONSGML v1.0//EN") : prodId);
-    return fmt.toICalString(event);
+    saveChanges();
+    emit saved(sequence);
 }
 
-void CalendarWorker::save()
+void CalendarWorker::saveChanges()
 {
     mStorage->save();
     // FIXME: should send response update if deleting an even we have responded to.
@@ -213,9 +204,27 @@ void CalendarWorker::save()
     }
 }
 
+QString CalendarWorker::convertEventToICalendar(const QString &uid, const QString &prodId) const
+{
+    // NOTE: not fetching eventInstances() with different recurrenceId
+    KCalendarCore::Event::Ptr event = mCalendar->event(uid);
+    if (!event && mStorage->load(uid)) {
+        event = mCalendar->event(uid);
+    }
+    if (event.isNull()) {
+        qWarning() << "No event with uid " << uid << ", unable to create iCalendar";
+        return QString();
+    }
+
+    KCalendarCore::ICalFormat fmt;
+    fmt.setApplication(fmt.application(),
+                       prodId.isEmpty() ? QLatin1String("-//sailfishos.org/Sailfish//NONSGML v1.0//EN") : prodId);
+    return fmt.toICalString(event);
+}
+
 void CalendarWorker::saveEvent(const CalendarData::Event &eventData, bool updateAttendees,
                                const QList<CalendarData::EmailContact> &required,
-                               const QList<CalendarData::EmailContact> &optional)
+                               const QList<CalendarData::EmailContact> &optional, int sequence)
 {
     QString notebookUid = eventData.calendarUid;
 
@@ -277,7 +286,8 @@ void CalendarWorker::saveEvent(const CalendarData::Event &eventData, bool update
         }
     }
 
-    save();
+    saveChanges();
+    emit saved(sequence);
 }
 
 void CalendarWorker::setEventData(KCalendarCore::Event::Ptr &event, const CalendarData::Event &eventData)
@@ -304,7 +314,7 @@ void CalendarWorker::setEventData(KCalendarCore::Event::Ptr &event, const Calend
 void CalendarWorker::replaceOccurrence(const CalendarData::Event &eventData, const QDateTime &startTime,
                                        bool updateAttendees,
                                        const QList<CalendarData::EmailContact> &required,
-                                       const QList<CalendarData::EmailContact> &optional)
+                                       const QList<CalendarData::EmailContact> &optional, int sequence)
 {
     QString notebookUid = eventData.calendarUid;
     if (!notebookUid.isEmpty() && !mStorage->isValidNotebook(notebookUid)) {
@@ -345,7 +355,8 @@ void CalendarWorker::replaceOccurrence(const CalendarData::Event &eventData, con
     mCalendar->addEvent(replacement, notebookUid);
 
     emit occurrenceExceptionCreated(eventData, startTime, replacement->recurrenceId());
-    save();
+    saveChanges();
+    emit saved(sequence);
 }
 
 void CalendarWorker::init()
@@ -715,6 +726,7 @@ void CalendarWorker::setNotebookColor(const QString &notebookUid, const QString
 QHash<QString, CalendarData::EventOccurrence>
 CalendarWorker::eventOccurrences(const QList<CalendarData::Range> &ranges) const
 {
+    CalendarTraceSpan span("CalendarWorker::eventOccurrences");
     mKCal::ExtendedCalendar::ExpandedIncidenceList events;
     foreach (CalendarData::Range range, ranges) {
         // mkcal fails to consider all day event end time inclusivity on this, add -1 days to start date
@@ -740,6 +752,8 @@ CalendarWorker::eventOccurrences(const QList<CalendarData::Range> &ranges) const
         occurrence.endTime = exp.first.dtEnd;
         filtered.insert(occurrence.getId(), occurrence);
     }
+    span.setCount("expanded", events.count());
+    span.setCount("occurrences", filtered.count());
 
     return filtered;
 }
@@ -749,6 +763,8 @@ CalendarWorker::dailyEventOccurrences(const QList<CalendarData::Range> &ranges,
                                       const QMultiHash<QString, QDateTime> &allDay,
                                       const QList<CalendarData::EventOccurrence> &occurrences)
 {
+    CalendarTraceSpan span("CalendarWorker::dailyEventOccurrences");
+    span.setCount("occurrences", occurrences.count());
     QHash<QDate, QStringList> occurrenceHash;
     foreach (const CalendarData::Range &range, ranges) {
         QDate start = range.first;
@@ -766,6 +782,7 @@ CalendarWorker::dailyEventOccurrences(const QList<CalendarData::Range> &ranges,
             start = start.addDays(1);
         }
     }
+    span.setCount("days", occurrenceHash.count());
     return occurrenceHash;
 }
 
@@ -773,15 +790,25 @@ void CalendarWorker::loadData(const QList<CalendarData::Range> &ranges,
                               const QStringList &uidList,
                               bool reset)
 {
-    foreach (const CalendarData::Range &range, ranges)
-        mStorage->load(range.first, range.second.addDays(1)); // end date is not inclusive
+    CalendarTraceSpan span("CalendarWorker::loadData");
+    span.setCount("ranges", ranges.count());
+    span.setCount("uids", uidList.count());
+
+    {
+        CalendarTraceSpan storageSpan("CalendarWorker::loadData storage");
+        foreach (const CalendarData::Range &range, ranges)
+            mStorage->load(range.first, range.second.addDays(1)); // end date is not inclusive
 
-    // Note: omitting recurrence ids since loadRecurringIncidences() loads them anyway
-    foreach (const QString &uid, uidList)
-        mStorage->load(uid);
+        // Note: omitting recurrence ids since loadRecurringIncidences() loads them anyway
+        foreach (const QString &uid, uidList)
+            mStorage->load(uid);
+    }
 
-    // Load all recurring incidences, we have no other way to detect if they occur within a range
-    mStorage->loadRecurringIncidences();
+    {
+        // Load all recurring incidences, we have no other way to detect if they occur within a range
+        CalendarTraceSpan recurringSpan("CalendarWorker::loadData recurring");
+        mStorage->loadRecurringIncidences();
+    }
 
     if (reset)
         mSentEvents.clear();
@@ -790,6 +817,7 @@ void CalendarWorker::loadData(const QList<CalendarData::Range> &ranges,
     QMultiHash<QString, QDateTime> allDay;
     bool orphansDeleted = false;
 
+    CalendarTraceSpan convertSpan("CalendarWorker::loadData convert");
     const KCalendarCore::Event::List list = mCalendar->rawEvents();
     for (const KCalendarCore::Event::Ptr e : list) {
         if (!mCalendar->isVisible(e)) {
@@ -829,40 +857,29 @@ void CalendarWorker::loadData(const QList<CalendarData::Range> &ranges,
         }
     }
 
+    convertSpan.setCount("incidences", list.count());
+    convertSpan.setCount("events", events.count());
+
     if (orphansDeleted) {
-        save(); // save the orphan deletions to storage.
+        saveChanges(); // save the orphan deletions to storage.
     }
 
     QHash<QString, CalendarData::EventOccurrence> occurrences = eventOccurrences(ranges);
     QHash<QDate, QStringList> dailyOccurrences = dailyEventOccurrences(ranges, allDay, occurrences.values());
+    span.setCount("events", events.count());
+    span.setCount("occurrences", occurrences.count());
 
+    // Queued to the manager thread, which copies the arguments.
+    CalendarTraceSpan emitSpan("CalendarWorker::loadData emit");
     emit dataLoaded(ranges, uidList, events, occurrences, dailyOccurrences, reset);
 }
 
 CalendarData::Event CalendarWorker::createEventStruct(const KCalendarCore::Event::Ptr &e,
                                                       mKCal::Notebook::Ptr notebook) const
 {
-    CalendarData::Event event;
-    event.uniqueId = e->uid();
-    event.recurrenceId = e->recurrenceId();
-    event.allDay = e->allDay();
+    CalendarData::Event event = CalendarUtils::convertEvent(e);
     event.calendarUid = mCalendar->notebook(e);
-    event.description = e->description();
-    event.displayLabel = e->summary();
-    event.endTime = e->dtEnd();
-    event.location = e->location();
-    event.secrecy = CalendarUtils::convertSecrecy(e);
     event.readOnly = mStorage->notebook(event.calendarUid)->isReadOnly();
-    event.recur = CalendarUtils::convertRecurrence(e);
-    event.recurWeeklyDays = CalendarUtils::convertDayPositions(e);
-    const QString &syncFailure = e->customProperty("VOLATILE", "SYNC-FAILURE");
-    if (syncFailure.compare("upload", Qt::CaseInsensitive) == 0) {
-        event.syncFailure = CalendarEvent::UploadFailure;
-    } else if (syncFailure.compare("update", Qt::CaseInsensitive) == 0) {
-        event.syncFailure = CalendarEvent::UpdateFailure;
-    } else if (syncFailure.compare("delete", Qt::CaseInsensitive) == 0) {
-        event.syncFailure = CalendarEvent::DeleteFailure;
-    }
     bool externalInvitation = false;
     const QString &calendarOwnerEmail = getNotebookAddress(e);
 
@@ -878,9 +895,7 @@ CalendarData::Event CalendarWorker::createEventStruct(const KCalendarCore::Event
     // however in some cases the account email and owner attendee email won't necessarily match
     // (e.g. in the case where server-side aliases are defined but unknown to the plugin).
     // So we handle this here to avoid "missing" some status changes due to owner email mismatch.
-    // This defaults to QString() -> ResponseUnspecified in case the property is undefined
-    event.ownerStatus = CalendarUtils::convertResponseType(e->nonKDECustomProperty("X-EAS-RESPONSE-TYPE"));
-
+    // The default, from X-EAS-RESPONSE-TYPE, is set in CalendarUtils::convertEvent().
     const KCalendarCore::Attendee::List attendees = e->attendees();
     for (const KCalendarCore::Attendee &calAttendee : attendees) {
         if (calAttendee.email() == calendarOwnerEmail) {
@@ -895,13 +910,6 @@ CalendarData::Event CalendarWorker::createEventStruct(const KCalendarCore::Event
         }
     }
 
-    KCalendarCore::RecurrenceRule *defaultRule = e->recurrence()->defaultRRule();
-    if (defaultRule) {
-        event.recurEndDate = defaultRule->endDt().date();
-    }
-    event.reminder = CalendarUtils::getReminder(e);
-    event.reminderDateTime = CalendarUtils::getReminderDateTime(e);
-    event.startTime = e->dtStart();
     return event;
 }
 
@@ -1035,34 +1043,3 @@ QList<CalendarData::Attendee> CalendarWorker::getEventAttendees(const QString &u
 
     return CalendarUtils::getEventAttendees(event);
 }
-
-void CalendarWorker::findMatchingEvent(const QString &invitationFile)
-{
-    KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::systemTimeZone()));
-    CalendarUtils::importFromFile(invitationFile, cal);
-    KCalendarCore::Incidence::List incidenceList = cal->incidences();
-    for (int i = 0; i < incidenceList.size(); i++) {
-        KCalendarCore::Incidence::Ptr incidence = incidenceList.at(i);
-        if (incidence->type() == KCalendarCore::IncidenceBase::TypeEvent) {
-            // Search for this event in the database.
-            loadData(QList<CalendarData::Range>() << qMakePair(incidence->dtStart().date().addDays(-1), incidence->dtStart().date().addDays(1)), QStringList(), false);
-            KCalendarCore::Incidence::List dbIncidences = mCalendar->incidences();
-            Q_FOREACH (KCalendarCore::Incidence::Ptr dbIncidence, dbIncidences) {
-                const QString remoteUidValue(dbIncidence->nonKDECustomProperty("X-SAILFISHOS-REMOTE-UID"));
-                if (dbIncidence->uid().compare(incidence->uid(), Qt::CaseInsensitive) == 0 ||
-                        remoteUidValue.compare(incidence->uid(), Qt::CaseInsensitive) == 0) {
-                    if ((!incidence->hasRecurrenceId() && !dbIncidence->hasRecurrenceId())
-                            || (incidence->hasRecurrenceId() && dbIncidence->hasRecurrenceId()
-                                && incidence->recurrenceId() == dbIncidence->recurrenceId())) {
-                        emit findMatchingEventFinished(invitationFile, createEventStruct(dbIncidence.staticCast<KCalendarCore::Event>()));
-                        return;
-                    }
-                }
-            }
-            break; // we only attempt to find the very first event, the invitation should only contain one.
-        }
-    }
-
-    // not found.
-    emit findMatchingEventFinished(invitationFile, CalendarData::Event());
-}
@@ -44,8 +44,6 @@
 // libaccounts-qt
 namespace Accounts { class Manager; }
 
-class CalendarInvitationQuery;
-
 class CalendarWorker : public QObject, public mKCal::ExtendedStorageObserver
 {
     Q_OBJECT
@@ -61,14 +59,14 @@ public:
 
 public slots:
     void init();
-    void save();
+    void save(int sequence);
 
     void saveEvent(const CalendarData::Event &eventData, bool updateAttendees,
                    const QList<CalendarData::EmailContact> &required,
-                   const QList<CalendarData::EmailContact> &optional);
+                   const QList<CalendarData::EmailContact> &optional, int sequence);
     void replaceOccurrence(const CalendarData::Event &eventData, const QDateTime &startTime, bool updateAttendees,
                            const QList<CalendarData::EmailContact> &required,
-                           const QList<CalendarData::EmailContact> &optional);
+                           const QList<CalendarData::EmailContact> &optional, int sequence);
     void deleteEvent(const QString &uid, const QDateTime &recurrenceId, const QDateTime &dateTime);
     void deleteAll(const QString &uid);
     bool sendResponse(const CalendarData::Event &eventData, const CalendarEvent::Response response);
@@ -87,10 +85,11 @@ public slots:
                                                     const QDateTime &startTime) const;
     QList<CalendarData::Attendee> getEventAttendees(const QString &uid, const QDateTime &recurrenceId);
 
-    void findMatchingEvent(const QString &invitationFile);
-
 signals:
     void storageModifiedSignal(const QString &info);
+    // The modifications up to the given sequence number of the manager
+    // are in the database.
+    void saved(int sequence);
 
     void eventNotebookChanged(const QString &oldEventUid, const QString &newEventUid, const QString &notebookUid);
 
@@ -109,10 +108,10 @@ signals:
     void occurrenceExceptionCreated(const CalendarData::Event &eventData, const QDateTime &startTime,
                                     const QDateTime &newRecurrenceId);
 
-    void findMatchingEventFinished(const QString &invitationFile,
-                                   const CalendarData::Event &eventData);
-
 private:
+    friend class bench_Calendar;
+
+    void saveChanges();
     void setEventData(KCalendarCore::Event::Ptr &event, const CalendarData::Event &eventData);
     void loadNotebooks();
     QStringList excludedNotebooks() const;
@@ -35,11 +35,15 @@ SOURCES += \
     $$SRCDIR/calendarnotebookmodel.cpp \
     $$SRCDIR/calendarmanager.cpp \
     $$SRCDIR/calendarworker.cpp \
+    $$SRCDIR/calendarreader.cpp \
     $$SRCDIR/calendarnotebookquery.cpp \
     $$SRCDIR/calendareventmodification.cpp \
     $$SRCDIR/calendarchangeinformation.cpp \
     $$SRCDIR/calendarutils.cpp \
+    $$SRCDIR/calendartrace.cpp \
     $$SRCDIR/calendarimportmodel.cpp \
+    $$SRCDIR/calendarimportparser.cpp \
+    $$SRCDIR/calendarimportwriter.cpp \
     $$SRCDIR/calendarimportevent.cpp \
     $$SRCDIR/calendarcontactmodel.cpp \
     $$SRCDIR/calendarattendeemodel.cpp
@@ -54,12 +58,16 @@ HEADERS += \
     $$SRCDIR/calendarnotebookmodel.h \
     $$SRCDIR/calendarmanager.h \
     $$SRCDIR/calendarworker.h \
+    $$SRCDIR/calendarreader.h \
     $$SRCDIR/calendardata.h \
     $$SRCDIR/calendarnotebookquery.h \
     $$SRCDIR/calendareventmodification.h \
     $$SRCDIR/calendarchangeinformation.h \
     $$SRCDIR/calendarutils.h \
+    $$SRCDIR/calendartrace.h \
     $$SRCDIR/calendarimportmodel.h \
+    $$SRCDIR/calendarimportparser.h \
+    $$SRCDIR/calendarimportwriter.h \
     $$SRCDIR/calendarimportevent.h \
     $$SRCDIR/calendarcontactmodel.h \
     $$SRCDIR/calendarattendeemodel.h
@@ -0,0 +1,811 @@
+/*
+ * Copyright (C) 2020 Open Mobile Platform LLC.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+// Benchmarks of the calendar data pipeline, from the storage to the
+// agenda model, and of the icalconverter tool, on generated databases.
+//
+// Sizes can be chosen with BENCH_CALENDAR_SIZES, e.g. "1000,10000".
+// Use the QTest output options, like "-o results.xml,xml" or "-csv",
+// to get results which can be compared between runs.
+
+#include <QObject>
+#include <QtTest>
+#include <QColor>
+#include <QDir>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+// mKCal
+#include "extendedcalendar.h"
+#include "extendedstorage.h"
+
+// kcalendarcore
+#include <KCalendarCore/CalFormat>
+
+#include "calendarworker.h"
+#include "calendarmanager.h"
+#include "calendaragendamodel.h"
+#include "calendareventoccurrence.h"
+#include "calendarevent.h"
+#include "../../lightweight/common/eventdata.h"
+
+class bench_Calendar : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit bench_Calendar(const QString &dataPath);
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void loadData_data();
+    void loadData();
+    void eventOccurrences_data();
+    void eventOccurrences();
+    void dailyEventOccurrences_data();
+    void dailyEventOccurrences();
+    void updateAgendaModel_data();
+    void updateAgendaModel();
+    void doRefresh_data();
+    void doRefresh();
+    void exportIcs_data();
+    void exportIcs();
+    void importIcs_data();
+    void importIcs();
+    void parseEventData_data();
+    void parseEventData();
+    void payloadSize_data();
+    void payloadSize();
+    void extractEventData_data();
+    void extractEventData();
+
+private:
+    struct LoadedData {
+        QMultiHash<QString, CalendarData::Event> events;
+        QHash<QString, CalendarData::EventOccurrence> occurrences;
+        QHash<QDate, QStringList> dailyOccurrences;
+    };
+
+    void addSizes();
+    QString databasePath(const QString &name) const;
+    QString generateDatabase(const QString &database, int count);
+    void useDatabase(int count);
+    void load(CalendarWorker *worker, LoadedData *data);
+    void eventPayloads(const LoadedData &data, EventDataList *eventDataList,
+                       CompactEventDataList *compactEventDataList) const;
+    QString icalconverter() const;
+    bool runIcalconverter(const QStringList &arguments, const QString &database) const;
+
+    QDir mDataDir;
+    QList<int> mSizes;
+    QHash<int, QString> mNotebookUids;
+    QList<CalendarData::Range> mRanges;
+};
+
+bench_Calendar::bench_Calendar(const QString &dataPath)
+    : mDataDir(dataPath)
+{
+}
+
+void bench_Calendar::initTestCase()
+{
+    const QByteArray sizes = qgetenv("BENCH_CALENDAR_SIZES");
+    const QList<QByteArray> sizeList = sizes.isEmpty()
+            ? QByteArray("1000,10000,100000").split(',') : sizes.split(',');
+    foreach (const QByteArray &size, sizeList) {
+        bool ok = false;
+        const int count = size.trimmed().toInt(&ok);
+        QVERIFY2(ok && count > 0, size.constData());
+        mSizes << count;
+    }
+
+    // Let the manager open its storage connections on the default
+    // database before switching the database for the generated ones.
+    CalendarManager *manager = CalendarManager::instance();
+    delete manager->getNextOccurrence(QString(), QDateTime(), QDateTime());
+    for (int i = 0; i < manager->mCalendarReaders.count(); ++i)
+        manager->convertEventToICalendarSync(QString(), QString());
+
+    // A month, as shown by the month view.
+    mRanges << CalendarData::Range(QDate(2021, 6, 1), QDate(2021, 6, 30));
+
+    foreach (int count, mSizes) {
+        const QString notebookUid = generateDatabase(databasePath(QString::number(count)), count);
+        QVERIFY(!notebookUid.isEmpty());
+        mNotebookUids.insert(count, notebookUid);
+    }
+}
+
+void bench_Calendar::cleanupTestCase()
+{
+    delete CalendarManager::instance(false);
+}
+
+void bench_Calendar::addSizes()
+{
+    QTest::addColumn<int>("count");
+
+    foreach (int count, mSizes)
+        QTest::newRow(QString::fromLatin1("%1 events").arg(count).toLatin1()) << count;
+}
+
+QString bench_Calendar::databasePath(const QString &name) const
+{
+    mDataDir.mkpath(name);
+    return mDataDir.filePath(name + QLatin1String("/db"));
+}
+
+// Fills a new database with events spread over 2021: one event out of ten
+// is recurring, with some exceptions, and the others are a mix of timed,
+// all-day and multi-day events.
+QString bench_Calendar::generateDatabase(const QString &database, int count)
+{
+    qputenv("SQLITESTORAGEDB", database.toUtf8());
+    mKCal::ExtendedCalendar::Ptr calendar(new mKCal::ExtendedCalendar(QTimeZone::systemTimeZone()));
+    mKCal::ExtendedStorage::Ptr storage = mKCal::ExtendedCalendar::defaultStorage(calendar);
+    if (!storage->open())
+        return QString();
+
+    mKCal::Notebook::Ptr notebook(new mKCal::Notebook(KCalendarCore::CalFormat::createUniqueId(),
+                                                      QLatin1String("Benchmark"),
+                                                      QLatin1String(""),
+                                                      "#110000",
+                                                      false, // Not shared.
+                                                      true, // Is master.
+                                                      false, // Not synced to Ovi.
+                                                      false, // Writable.
+                                                      true)); // Visible.
+    if (!storage->addNotebook(notebook) || !storage->setDefaultNotebook(notebook)) {
+        storage->close();
+        return QString();
+    }
+
+    const QDateTime yearStart(QDate(2021, 1, 1), QTime(8, 0), QTimeZone::systemTimeZone());
+    for (int i = 0; i < count; ++i) {
+        KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+        event->setSummary(QString::fromLatin1("Event %1").arg(i));
+        event->setLocation(QString::fromLatin1("Room %1").arg(i % 50));
+
+        const QDateTime start = yearStart.addDays((i * 7919) % 365).addSecs((i % 10) * 3600);
+        switch (i % 20) {
+        case 0:
+            event->setDtStart(start);
+            event->setDtEnd(start.addSecs(3600));
+            event->recurrence()->setWeekly(1);
+            event->recurrence()->setDuration(52);
+            break;
+        case 1:
+            event->setDtStart(start);
+            event->setDtEnd(start.addSecs(1800));
+            event->recurrence()->setDaily(1);
+            event->recurrence()->setDuration(30);
+            break;
+        case 2:
+        case 3:
+            event->setDtStart(QDateTime(start.date()));
+            event->setDtEnd(QDateTime(start.date()));
+            event->setAllDay(true);
+            break;
+        case 4:
+            event->setDtStart(start);
+            event->setDtEnd(start.addDays(3));
+            break;
+        case 5:
+            event->setDtStart(QDateTime(start.date()));
+            event->setDtEnd(QDateTime(start.date().addDays(1 + i % 3)));
+            event->setAllDay(true);
+            break;
+        default:
+            event->setDtStart(start);
+            event->setDtEnd(start.addSecs(3600));
+            break;
+        }
+        if (!calendar->addEvent(event, notebook->uid())) {
+            storage->close();
+            return QString();
+        }
+
+        // Move the third occurrence of every other recurring event.
+        if (i % 40 < 2) {
+            const QDateTime occurrence = i % 40 ? start.addDays(2) : start.addDays(14);
+            KCalendarCore::Incidence::Ptr exception = calendar->dissociateSingleOccurrence(event, occurrence);
+            if (exception) {
+                exception->setDtStart(occurrence.addSecs(3600));
+                exception.staticCast<KCalendarCore::Event>()->setDtEnd(occurrence.addSecs(5400));
+                calendar->addEvent(exception.staticCast<KCalendarCore::Event>(), notebook->uid());
+            }
+        }
+
+        if (i % 1000 == 999)
+            storage->save();
+    }
+    storage->save();
+    storage->close();
+
+    return notebook->uid();
+}
+
+void bench_Calendar::useDatabase(int count)
+{
+    qputenv("SQLITESTORAGEDB", databasePath(QString::number(count)).toUtf8());
+}
+
+void bench_Calendar::load(CalendarWorker *worker, LoadedData *data)
+{
+    connect(worker, &CalendarWorker::dataLoaded,
+            [data] (const QList<CalendarData::Range> &,
+                    const QStringList &,
+                    const QMultiHash<QString, CalendarData::Event> &events,
+                    const QHash<QString, CalendarData::EventOccurrence> &occurrences,
+                    const QHash<QDate, QStringList> &dailyOccurrences,
+                    bool) {
+        data->events = events;
+        data->occurrences = occurrences;
+        data->dailyOccurrences = dailyOccurrences;
+    });
+    worker->loadData(mRanges, QStringList(), true);
+}
+
+void bench_Calendar::loadData_data()
+{
+    addSizes();
+}
+
+void bench_Calendar::loadData()
+{
+    QFETCH(int, count);
+
+    useDatabase(count);
+    CalendarWorker worker;
+    worker.init();
+
+    // Storage keeps track of the loaded ranges, so only a first load is meaningful.
+    LoadedData data;
+    QBENCHMARK_ONCE {
+        load(&worker, &data);
+    }
+    QVERIFY(!data.occurrences.isEmpty());
+}
+
+void bench_Calendar::eventOccurrences_data()
+{
+    addSizes();
+}
+
+void bench_Calendar::eventOccurrences()
+{
+    QFETCH(int, count);
+
+    useDatabase(count);
+    CalendarWorker worker;
+    worker.init();
+    LoadedData data;
+    load(&worker, &data);
+
+    QHash<QString, CalendarData::EventOccurrence> occurrences;
+    QBENCHMARK {
+        occurrences = worker.eventOccurrences(mRanges);
+    }
+    QCOMPARE(occurrences.count(), data.occurrences.count());
+}
+
+void bench_Calendar::dailyEventOccurrences_data()
+{
+    addSizes();
+}
+
+void bench_Calendar::dailyEventOccurrences()
+{
+    QFETCH(int, count);
+
+    useDatabase(count);
+    CalendarWorker worker;
+    worker.init();
+    LoadedData data;
+    load(&worker, &data);
+
+    QMultiHash<QString, QDateTime> allDay;
+    foreach (const CalendarData::Event &event, data.events) {
+        if (event.allDay)
+            allDay.insert(event.uniqueId, event.recurrenceId);
+    }
+    const QList<CalendarData::EventOccurrence> occurrences = data.occurrences.values();
+
+    QHash<QDate, QStringList> dailyOccurrences;
+    QBENCHMARK {
+        dailyOccurrences = worker.dailyEventOccurrences(mRanges, allDay, occurrences);
+    }
+    QCOMPARE(dailyOccurrences.count(), data.dailyOccurrences.count());
+}
+
+void bench_Calendar::updateAgendaModel_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<QDate>("startDate");
+    QTest::addColumn<QDate>("endDate");
+
+    foreach (int count, mSizes) {
+        QTest::newRow(QString::fromLatin1("%1 events, day").arg(count).toLatin1())
+                << count << QDate(2021, 6, 15) << QDate(2021, 6, 15);
+        QTest::newRow(QString::fromLatin1("%1 events, month").arg(count).toLatin1())
+                << count << QDate(2021, 6, 1) << QDate(2021, 6, 30);
+    }
+}
+
+void bench_Calendar::updateAgendaModel()
+{
+    QFETCH(int, count);
+    QFETCH(QDate, startDate);
+    QFETCH(QDate, endDate);
+
+    useDatabase(count);
+    CalendarWorker worker;
+    worker.init();
+    LoadedData data;
+    load(&worker, &data);
+
+    CalendarManager *manager = CalendarManager::instance();
+    manager->dataLoadedSlot(mRanges, QStringList(), data.events, data.occurrences,
+                            data.dailyOccurrences, true);
+
+    // Not completed, so that the model doesn't schedule refreshes on its own.
+    CalendarAgendaModel model;
+    model.classBegin();
+    model.setStartDate(startDate);
+    model.setEndDate(endDate);
+
+    QBENCHMARK {
+        manager->updateAgendaModel(&model);
+    }
+    QVERIFY(model.count() > 0);
+}
+
+void bench_Calendar::doRefresh_data()
+{
+    addSizes();
+}
+
+void bench_Calendar::doRefresh()
+{
+    QFETCH(int, count);
+
+    useDatabase(count);
+    CalendarWorker worker;
+    worker.init();
+    LoadedData data;
+    load(&worker, &data);
+
+    CalendarAgendaModel model;
+    model.classBegin();
+
+    // Refreshes the model with the same occurrences, like after an
+    // unrelated storage modification.
+    QBENCHMARK {
+        QList<CalendarEventOccurrence *> occurrences;
+        foreach (const CalendarData::EventOccurrence &eo, data.occurrences) {
+            occurrences.append(new CalendarEventOccurrence(eo.eventUid, eo.recurrenceId,
+                                                           eo.startTime, eo.endTime));
+        }
+        model.doRefresh(occurrences);
+    }
+    QCOMPARE(model.count(), data.occurrences.count());
+}
+
+// Builds the getEventsResult and getEventsResultV2 payloads of the data
+// service for the loaded occurrences.
+void bench_Calendar::eventPayloads(const LoadedData &data, EventDataList *eventDataList,
+                                   CompactEventDataList *compactEventDataList) const
+{
+    const QString color = QStringLiteral("#00aeef");
+    foreach (const CalendarData::EventOccurrence &eo, data.occurrences) {
+        CalendarData::Event event;
+        foreach (const CalendarData::Event &e, data.events.values(eo.eventUid)) {
+            if (e.recurrenceId == eo.recurrenceId)
+                event = e;
+        }
+        if (!event.isValid())
+            continue;
+
+        EventData eventStruct;
+        CompactEventData compactStruct;
+        eventStruct.displayLabel = compactStruct.displayLabel = event.displayLabel;
+        eventStruct.description = compactStruct.description = event.description;
+        if (event.allDay) {
+            eventStruct.startTime = eo.startTime.date().toString(Qt::ISODate);
+            eventStruct.endTime = eo.endTime.date().toString(Qt::ISODate);
+            compactStruct.startTime = QDateTime(eo.startTime.date(), QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+            compactStruct.endTime = QDateTime(eo.endTime.date(), QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+        } else {
+            eventStruct.startTime = eo.startTime.toString(Qt::ISODate);
+            eventStruct.endTime = eo.endTime.toString(Qt::ISODate);
+            compactStruct.startTime = eo.startTime.toMSecsSinceEpoch();
+            compactStruct.endTime = eo.endTime.toMSecsSinceEpoch();
+        }
+        eventStruct.allDay = compactStruct.allDay = event.allDay;
+        eventStruct.color = color;
+        eventStruct.recurrenceId = compactStruct.recurrenceId = event.recurrenceId.toString(Qt::ISODate);
+        eventStruct.uniqueId = compactStruct.uniqueId = event.uniqueId;
+        eventStruct.calendarUid = event.calendarUid;
+        eventStruct.location = compactStruct.location = event.location;
+        compactStruct.notebook = compactEventDataList->notebookIndex(event.calendarUid, color);
+        *eventDataList << eventStruct;
+        compactEventDataList->events << compactStruct;
+    }
+}
+
+// Size of the marshalled D-Bus message body, following the alignment
+// rules of the specification.
+static int dbusAlign(int size, int alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static int dbusString(int size, const QString &string)
+{
+    return dbusAlign(size, 4) + 4 + string.toUtf8().size() + 1;
+}
+
+static int dbusPayloadSize(const EventDataList &eventDataList)
+{
+    int size = dbusAlign(0, 4) + 4; // array length
+    foreach (const EventData &e, eventDataList) {
+        size = dbusAlign(size, 8); // struct
+        size = dbusString(size, e.calendarUid);
+        size = dbusString(size, e.uniqueId);
+        size = dbusString(size, e.recurrenceId);
+        size = dbusString(size, e.startTime);
+        size = dbusString(size, e.endTime);
+        size = dbusAlign(size, 4) + 4; // bool
+        size = dbusString(size, e.color);
+        size = dbusString(size, e.displayLabel);
+        size = dbusString(size, e.description);
+        size = dbusString(size, e.location);
+    }
+    return size;
+}
+
+static int dbusPayloadSize(const CompactEventDataList &eventDataList)
+{
+    int size = 4; // notebook array length
+    foreach (const CompactNotebookData &n, eventDataList.notebooks) {
+        size = dbusAlign(size, 8);
+        size = dbusString(size, n.uid);
+        size = dbusString(size, n.color);
+    }
+    size = dbusAlign(size, 4) + 4; // event array length
+    foreach (const CompactEventData &e, eventDataList.events) {
+        size = dbusAlign(size, 8);
+        size = dbusString(size, e.uniqueId);
+        size = dbusString(size, e.recurrenceId);
+        size = dbusAlign(size, 8) + 8 + 8; // times
+        size += 4 + 4; // bool, notebook index
+        size = dbusString(size, e.displayLabel);
+        size = dbusString(size, e.description);
+        size = dbusString(size, e.location);
+    }
+    return size;
+}
+
+void bench_Calendar::parseEventData_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("compact");
+
+    foreach (int count, mSizes) {
+        QTest::newRow(QString::fromLatin1("%1 events, strings").arg(count).toLatin1()) << count << false;
+        QTest::newRow(QString::fromLatin1("%1 events, compact").arg(count).toLatin1()) << count << true;
+    }
+}
+
+// Client side handling of a data service reply, as done by CalendarEventsModel
+// before and after the switch to getEventsResultV2.
+void bench_Calendar::parseEventData()
+{
+    QFETCH(int, count);
+    QFETCH(bool, compact);
+
+    useDatabase(count);
+    CalendarWorker worker;
+    worker.init();
+    LoadedData data;
+    load(&worker, &data);
+
+    EventDataList eventDataList;
+    CompactEventDataList compactEventDataList;
+    eventPayloads(data, &eventDataList, &compactEventDataList);
+    QVERIFY(!eventDataList.isEmpty());
+
+    QDateTime start;
+    QDateTime end;
+    QColor color;
+    if (compact) {
+        QBENCHMARK {
+            QVector<QColor> colors;
+            foreach (const CompactNotebookData &n, compactEventDataList.notebooks)
+                colors.append(QColor(n.color));
+            foreach (const CompactEventData &e, compactEventDataList.events) {
+                if (e.allDay) {
+                    start = QDateTime(QDateTime::fromMSecsSinceEpoch(e.startTime, Qt::UTC).date());
+                    end = QDateTime(QDateTime::fromMSecsSinceEpoch(e.endTime, Qt::UTC).date());
+                } else {
+                    start = QDateTime::fromMSecsSinceEpoch(e.startTime);
+                    end = QDateTime::fromMSecsSinceEpoch(e.endTime);
+                }
+                color = colors.value(e.notebook);
+            }
+        }
+    } else {
+        QBENCHMARK {
+            foreach (const EventData &e, eventDataList) {
+                if (e.allDay) {
+                    start = QDateTime(QDate::fromString(e.startTime, Qt::ISODate));
+                    end = QDateTime(QDate::fromString(e.endTime, Qt::ISODate));
+                } else {
+                    start = QDateTime::fromString(e.startTime, Qt::ISODate);
+                    end = QDateTime::fromString(e.endTime, Qt::ISODate);
+                }
+                color = QColor(e.color);
+            }
+        }
+    }
+    QVERIFY(start.isValid());
+}
+
+void bench_Calendar::payloadSize_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<QString>("measure");
+
+    foreach (int count, mSizes) {
+        QTest::newRow(QString::fromLatin1("%1 events, occurrences").arg(count).toLatin1())
+                << count << QStringLiteral("occurrences");
+        QTest::newRow(QString::fromLatin1("%1 events, strings payload").arg(count).toLatin1())
+                << count << QStringLiteral("strings");
+        QTest::newRow(QString::fromLatin1("%1 events, compact payload").arg(count).toLatin1())
+                << count << QStringLiteral("compact");
+    }
+}
+
+// Not timed, reports the number of occurrences of a data service reply,
+// and its D-Bus payload size before and after getEventsResultV2.
+void bench_Calendar::payloadSize()
+{
+    QFETCH(int, count);
+    QFETCH(QString, measure);
+
+    useDatabase(count);
+    CalendarWorker worker;
+    worker.init();
+    LoadedData data;
+    load(&worker, &data);
+
+    EventDataList eventDataList;
+    CompactEventDataList compactEventDataList;
+    eventPayloads(data, &eventDataList, &compactEventDataList);
+    QVERIFY(!eventDataList.isEmpty());
+
+    if (measure == QLatin1String("occurrences"))
+        QTest::setBenchmarkResult(eventDataList.count(), QTest::Events);
+    else if (measure == QLatin1String("compact"))
+        QTest::setBenchmarkResult(dbusPayloadSize(compactEventDataList), QTest::BytesAllocated);
+    else
+        QTest::setBenchmarkResult(dbusPayloadSize(eventDataList), QTest::BytesAllocated);
+}
+
+void bench_Calendar::extractEventData_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("bulk");
+
+    foreach (int count, mSizes) {
+        QTest::newRow(QString::fromLatin1("%1 events, agenda model").arg(count).toLatin1()) << count << false;
+        QTest::newRow(QString::fromLatin1("%1 events, CalendarManager::agenda").arg(count).toLatin1()) << count << true;
+    }
+}
+
+// Reading a month for a data service reply, through the agenda model
+// as the service used to, or in bulk from the manager.
+void bench_Calendar::extractEventData()
+{
+    QFETCH(int, count);
+    QFETCH(bool, bulk);
+
+    useDatabase(count);
+    CalendarWorker worker;
+    worker.init();
+    LoadedData data;
+    load(&worker, &data);
+
+    CalendarManager *manager = CalendarManager::instance();
+    manager->dataLoadedSlot(mRanges, QStringList(), data.events, data.occurrences,
+                            data.dailyOccurrences, true);
+
+    CalendarAgendaModel model;
+    model.classBegin();
+    model.setStartDate(mRanges.first().first);
+    model.setEndDate(mRanges.first().second);
+    manager->updateAgendaModel(&model);
+    QVERIFY(model.count() > 0);
+
+    CompactEventDataList eventDataList;
+    if (bulk) {
+        QBENCHMARK {
+            eventDataList = CompactEventDataList();
+            foreach (const CalendarManager::AgendaItem &item, manager->agenda(model.startDate(), model.endDate())) {
+                CompactEventData eventStruct;
+                eventStruct.displayLabel = item.second->displayLabel;
+                eventStruct.description = item.second->description;
+                eventStruct.startTime = item.first->startTime.toMSecsSinceEpoch();
+                eventStruct.endTime = item.first->endTime.toMSecsSinceEpoch();
+                eventStruct.allDay = item.second->allDay;
+                eventStruct.notebook = eventDataList.notebookIndex(item.second->calendarUid,
+                                                                   manager->getNotebookColor(item.second->calendarUid));
+                eventStruct.uniqueId = item.second->uniqueId;
+                eventStruct.location = item.second->location;
+                eventDataList.events << eventStruct;
+            }
+        }
+    } else {
+        QBENCHMARK {
+            eventDataList = CompactEventDataList();
+            for (int i = 0; i < model.count(); i++) {
+                CalendarEvent *event = model.get(i, CalendarAgendaModel::EventObjectRole).value<CalendarEvent *>();
+                CalendarEventOccurrence *occurrence
+                        = model.get(i, CalendarAgendaModel::OccurrenceObjectRole).value<CalendarEventOccurrence *>();
+                CompactEventData eventStruct;
+                eventStruct.displayLabel = event->displayLabel();
+                eventStruct.description = event->description();
+                eventStruct.startTime = occurrence->startTime().toMSecsSinceEpoch();
+                eventStruct.endTime = occurrence->endTime().toMSecsSinceEpoch();
+                eventStruct.allDay = event->allDay();
+                eventStruct.notebook = eventDataList.notebookIndex(event->calendarUid(), event->color());
+                eventStruct.uniqueId = event->uniqueId();
+                eventStruct.location = event->location();
+                eventDataList.events << eventStruct;
+            }
+        }
+    }
+    QCOMPARE(eventDataList.events.count(), model.count());
+}
+
+QString bench_Calendar::icalconverter() const
+{
+    const QString path = QString::fromLocal8Bit(qgetenv("ICALCONVERTER"));
+    if (!path.isEmpty())
+        return path;
+
+    const QString built = QDir(QCoreApplication::applicationDirPath())
+            .filePath(QLatin1String("../../tools/icalconverter/icalconverter"));
+    if (QFileInfo(built).isExecutable())
+        return built;
+
+    return QStandardPaths::findExecutable(QLatin1String("icalconverter"));
+}
+
+bool bench_Calendar::runIcalconverter(const QStringList &arguments, const QString &database) const
+{
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert(QLatin1String("SQLITESTORAGEDB"), database);
+
+    QProcess process;
+    process.setProcessEnvironment(environment);
+    process.setStandardOutputFile(QProcess::nullDevice());
+    process.setStandardErrorFile(QProcess::nullDevice());
+    process.start(icalconverter(), arguments);
+    if (!process.waitForFinished(-1))
+        return false;
+
+    return process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0;
+}
+
+void bench_Calendar::exportIcs_data()
+{
+    addSizes();
+}
+
+void bench_Calendar::exportIcs()
+{
+    QFETCH(int, count);
+
+    if (icalconverter().isEmpty())
+        QSKIP("icalconverter not found, set ICALCONVERTER to its path");
+
+    const QString backup = mDataDir.filePath(QString::fromLatin1("export-%1.ics").arg(count));
+    bool success = false;
+    QBENCHMARK_ONCE {
+        success = runIcalconverter(QStringList() << "export" << "-n" << mNotebookUids.value(count) << backup,
+                                   databasePath(QString::number(count)));
+    }
+    QVERIFY(success);
+    QVERIFY(QFileInfo(backup).size() > 0);
+}
+
+void bench_Calendar::importIcs_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("unchanged");
+
+    foreach (int count, mSizes) {
+        QTest::newRow(QString::fromLatin1("%1 events").arg(count).toLatin1()) << count << false;
+        QTest::newRow(QString::fromLatin1("%1 events, unchanged").arg(count).toLatin1()) << count << true;
+    }
+}
+
+void bench_Calendar::importIcs()
+{
+    QFETCH(int, count);
+    QFETCH(bool, unchanged);
+
+    if (icalconverter().isEmpty())
+        QSKIP("icalconverter not found, set ICALCONVERTER to its path");
+
+    const QString backup = mDataDir.filePath(QString::fromLatin1("export-%1.ics").arg(count));
+    if (!QFileInfo::exists(backup)) {
+        QVERIFY(runIcalconverter(QStringList() << "export" << "-n" << mNotebookUids.value(count) << backup,
+                                 databasePath(QString::number(count))));
+    }
+
+    // Import into an empty notebook, or over a previous import of the same data.
+    const QString name = QString::fromLatin1("import-%1").arg(count);
+    const QString database = databasePath(name);
+    QDir(mDataDir.filePath(name)).removeRecursively();
+    const QString notebookUid = generateDatabase(databasePath(name), 0);
+    QVERIFY(!notebookUid.isEmpty());
+    const QStringList arguments = QStringList() << "import" << "-n" << notebookUid << backup;
+    if (unchanged)
+        QVERIFY(runIcalconverter(arguments, database));
+
+    bool success = false;
+    QBENCHMARK_ONCE {
+        success = runIcalconverter(arguments, database);
+    }
+    QVERIFY(success);
+}
+
+int main(int argc, char *argv[])
+{
+    // Keep the generated databases, and the settings of the plugin,
+    // away from the user data.
+    QTemporaryDir home;
+    if (!home.isValid())
+        return 1;
+    qputenv("HOME", home.path().toUtf8());
+    qputenv("SQLITESTORAGEDB", QDir(home.path()).filePath(QLatin1String("db")).toUtf8());
+
+    QCoreApplication app(argc, argv);
+    bench_Calendar bench(home.path());
+    return QTest::qExec(&bench, argc, argv);
+}
+
+#include "bench_calendar.moc"
@@ -0,0 +1,7 @@
+include(../common.pri)
+
+TARGET = bench_calendar
+QT += dbus gui
+HEADERS += ../../lightweight/common/eventdata.h
+SOURCES += bench_calendar.cpp \
+    ../../lightweight/common/eventdata.cpp
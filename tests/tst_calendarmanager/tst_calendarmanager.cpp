@@ -21,6 +21,8 @@ private slots:
     void test_addRanges_data();
     void test_addRanges();
     void test_notebookApi();
+    void test_statistics();
+    void test_agenda();
     void cleanupTestCase();
 
 private:
@@ -598,6 +600,109 @@ void tst_CalendarManager::test_notebookApi()
     QCOMPARE(defaultNotebookSpy.count(), 3);
 }
 
+void tst_CalendarManager::test_statistics()
+{
+    CalendarData::Event event;
+    event.uniqueId = QStringLiteral("statistics-event");
+    event.startTime = QDateTime(QDate(2014, 3, 5), QTime(10, 0));
+    event.endTime = QDateTime(QDate(2014, 3, 5), QTime(11, 0));
+    QMultiHash<QString, CalendarData::Event> events;
+    events.insert(event.uniqueId, event);
+
+    CalendarData::EventOccurrence occurrence;
+    occurrence.eventUid = event.uniqueId;
+    occurrence.startTime = event.startTime;
+    occurrence.endTime = event.endTime;
+    QHash<QString, CalendarData::EventOccurrence> occurrences;
+    occurrences.insert(occurrence.getId(), occurrence);
+
+    QHash<QDate, QStringList> dailyOccurrences;
+    dailyOccurrences.insert(QDate(2014, 3, 5), QStringList() << occurrence.getId());
+
+    QList<CalendarData::Range> ranges;
+    ranges << CalendarData::Range(QDate(2014, 3, 1), QDate(2014, 3, 31));
+
+    mManager.dataLoadedSlot(ranges, QStringList(), events, occurrences, dailyOccurrences, true);
+
+    const QVariantMap statistics = mManager.statistics();
+    QCOMPARE(statistics.value("events").toInt(), 1);
+    QCOMPARE(statistics.value("occurrences").toInt(), 1);
+    QCOMPARE(statistics.value("days").toInt(), 1);
+    QCOMPARE(statistics.value("loadedRanges").toStringList(), QStringList() << "2014-03-01/2014-03-31");
+    QVERIFY(statistics.value("memoryUsage").toLongLong() > 0);
+    QVERIFY(statistics.contains("loadLatency95"));
+    QVERIFY(statistics.contains("rangeHits"));
+    QVERIFY(statistics.contains("parseCacheHits"));
+    QCOMPARE(statistics.value("parseCacheEntries").toInt(), 0);
+}
+
+void tst_CalendarManager::test_agenda()
+{
+    QMultiHash<QString, CalendarData::Event> events;
+    QHash<QString, CalendarData::EventOccurrence> occurrences;
+    QHash<QDate, QStringList> dailyOccurrences;
+    const QStringList labels = QStringList() << "b" << "A" << "c";
+    for (int i = 0; i < labels.count(); ++i) {
+        CalendarData::Event event;
+        event.uniqueId = QStringLiteral("agenda-event-%1").arg(i);
+        event.displayLabel = labels.at(i);
+        // The last one the day after, the others at the same time.
+        event.startTime = QDateTime(QDate(2014, 4, i < 2 ? 5 : 6), QTime(10, 0));
+        event.endTime = event.startTime.addSecs(3600);
+        events.insert(event.uniqueId, event);
+
+        CalendarData::EventOccurrence occurrence;
+        occurrence.eventUid = event.uniqueId;
+        occurrence.startTime = event.startTime;
+        occurrence.endTime = event.endTime;
+        occurrences.insert(occurrence.getId(), occurrence);
+        dailyOccurrences[event.startTime.date()] << occurrence.getId();
+    }
+
+    QList<CalendarData::Range> ranges;
+    ranges << CalendarData::Range(QDate(2014, 4, 1), QDate(2014, 4, 30));
+    mManager.dataLoadedSlot(ranges, QStringList(), events, occurrences, dailyOccurrences, true);
+
+    QList<CalendarManager::AgendaItem> agenda = mManager.agenda(QDate(2014, 4, 1), QDate(2014, 4, 30));
+    QCOMPARE(agenda.count(), 3);
+    QCOMPARE(agenda.at(0).second->displayLabel, QStringLiteral("A"));
+    QCOMPARE(agenda.at(1).second->displayLabel, QStringLiteral("b"));
+    QCOMPARE(agenda.at(2).second->displayLabel, QStringLiteral("c"));
+    QCOMPARE(agenda.at(2).first->startTime, QDateTime(QDate(2014, 4, 6), QTime(10, 0)));
+
+    // A single day comes from the daily index.
+    agenda = mManager.agenda(QDate(2014, 4, 6), QDate(2014, 4, 6));
+    QCOMPARE(agenda.count(), 1);
+    QCOMPARE(agenda.at(0).second->uniqueId, QStringLiteral("agenda-event-2"));
+
+    QVERIFY(mManager.agenda(QDate(2014, 4, 7), QDate(2014, 4, 30)).isEmpty());
+
+    // Occurrences covering several days are listed once.
+    CalendarData::Event multiDay;
+    multiDay.uniqueId = QStringLiteral("agenda-event-multiday");
+    multiDay.displayLabel = QStringLiteral("d");
+    multiDay.startTime = QDateTime(QDate(2014, 4, 10), QTime(10, 0));
+    multiDay.endTime = QDateTime(QDate(2014, 4, 12), QTime(10, 0));
+    CalendarData::EventOccurrence multiDayOccurrence;
+    multiDayOccurrence.eventUid = multiDay.uniqueId;
+    multiDayOccurrence.startTime = multiDay.startTime;
+    multiDayOccurrence.endTime = multiDay.endTime;
+    QMultiHash<QString, CalendarData::Event> multiDayEvents;
+    multiDayEvents.insert(multiDay.uniqueId, multiDay);
+    QHash<QString, CalendarData::EventOccurrence> multiDayOccurrences;
+    multiDayOccurrences.insert(multiDayOccurrence.getId(), multiDayOccurrence);
+    QHash<QDate, QStringList> multiDayDailyOccurrences;
+    for (QDate day(2014, 4, 10); day <= QDate(2014, 4, 12); day = day.addDays(1))
+        multiDayDailyOccurrences[day] << multiDayOccurrence.getId();
+    mManager.dataLoadedSlot(ranges, QStringList(), multiDayEvents, multiDayOccurrences,
+                            multiDayDailyOccurrences, false);
+
+    QCOMPARE(mManager.agenda(QDate(2014, 4, 1), QDate(2014, 4, 30)).count(), 4);
+    agenda = mManager.agenda(QDate(2014, 4, 11), QDate(2014, 4, 30));
+    QCOMPARE(agenda.count(), 1);
+    QCOMPARE(agenda.at(0).second->uniqueId, multiDay.uniqueId);
+}
+
 void tst_CalendarManager::cleanupTestCase()
 {
     CalendarManager::instance()->setDefaultNotebook(mDefaultNotebook);
@@ -1,6 +1,7 @@
 TEMPLATE=app
 TARGET=icalconverter
 QT-=gui
+QT+=concurrent
 CONFIG += link_pkgconfig
 PKGCONFIG += KF5CalendarCore libmkcal-qt5
 QMAKE_CXXFLAGS += -fPIE -fvisibility=hidden -fvisibility-inlines-hidden
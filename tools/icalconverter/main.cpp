@@ -35,10 +35,19 @@
 #include <QStringList>
 #include <QString>
 #include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSet>
+#include <QSettings>
+#include <QCryptographicHash>
 #include <QBuffer>
 #include <QDataStream>
 #include <QTextStream>
+#include <QThread>
 #include <QtDebug>
+#include <QtConcurrent>
+
+#include <algorithm>
 
 #include <KCalendarCore/MemoryCalendar>
 #include <KCalendarCore/ICalFormat>
@@ -76,6 +85,9 @@
 }
 
 namespace {
+    // Marks the incidences of a delta export which were deleted since the cut-off.
+    const QByteArray DeletedProperty("X-NEMO-DELETED");
+
     mKCal::Notebook::Ptr defaultLocalCalendarNotebook(mKCal::ExtendedStorage::Ptr storage)
     {
         mKCal::Notebook::List notebooks = storage->notebooks();
@@ -362,6 +374,78 @@ namespace CalendarImportExport {
             }
         }
 
+        // Hashes the properties copied by copyIncidenceProperties(), so that
+        // incidences with equal hashes need no update.
+        QByteArray contentHash(const KCalendarCore::Incidence::Ptr &incidence)
+        {
+            QByteArray data;
+            QDataStream stream(&data, QIODevice::WriteOnly);
+
+            stream << int(incidence->type());
+            {
+                // the date lists are compared in any order, so sort them before hashing
+                KCalendarCore::ICalFormat icalFormat;
+                const KCalendarCore::Recurrence *recurrence = incidence->recurrence();
+                Q_FOREACH (KCalendarCore::RecurrenceRule *rule, recurrence->rRules()) {
+                    stream << icalFormat.toString(rule);
+                }
+                Q_FOREACH (KCalendarCore::RecurrenceRule *rule, recurrence->exRules()) {
+                    stream << icalFormat.toString(rule);
+                }
+                KCalendarCore::DateList rDates = recurrence->rDates();
+                std::sort(rDates.begin(), rDates.end());
+                QList<QDateTime> rDateTimes = recurrence->rDateTimes();
+                std::sort(rDateTimes.begin(), rDateTimes.end());
+                KCalendarCore::DateList exDates = recurrence->exDates();
+                std::sort(exDates.begin(), exDates.end());
+                QList<QDateTime> exDateTimes = recurrence->exDateTimes();
+                std::sort(exDateTimes.begin(), exDateTimes.end());
+                stream << rDates << rDateTimes << exDates << exDateTimes;
+            }
+            stream << incidence->duration().asSeconds() << incidence->duration().isDaily();
+
+            if (incidence->type() == KCalendarCore::IncidenceBase::TypeEvent) {
+                KCalendarCore::Event::Ptr event = incidence.staticCast<KCalendarCore::Event>();
+                stream << event->dtEnd() << int(event->transparency());
+            } else if (incidence->type() == KCalendarCore::IncidenceBase::TypeTodo) {
+                KCalendarCore::Todo::Ptr todo = incidence.staticCast<KCalendarCore::Todo>();
+                stream << todo->completed() << todo->dtRecurrence() << todo->percentComplete();
+            }
+
+            KCalendarCore::Person organizer(incidence->organizer());
+            normalizePersonEmail(&organizer);
+            stream << incidence->dtStart() << incidence->allDay() << incidence->hasDuration()
+                   << organizer.name() << organizer.email() << incidence->isReadOnly();
+
+            Q_FOREACH (const KCalendarCore::Attendee &attendee, incidence->attendees()) {
+                stream << attendee.name() << attendee.email() << attendee.uid() << int(attendee.role())
+                       << int(attendee.status()) << attendee.RSVP() << attendee.delegate() << attendee.delegator()
+                       << int(attendee.cuType()) << attendee.customProperties().customProperties();
+            }
+
+            stream << incidence->comments() << incidence->contacts() << incidence->altDescription()
+                   << incidence->categories() << incidence->customStatus() << incidence->description()
+                   << incidence->geoLatitude() << incidence->geoLongitude() << incidence->hasGeo()
+                   << incidence->location() << incidence->resources() << int(incidence->secrecy())
+                   << int(incidence->status()) << incidence->summary() << incidence->revision();
+
+            Q_FOREACH (const KCalendarCore::Alarm::Ptr &alarm, incidence->alarms()) {
+                stream << int(alarm->type()) << alarm->enabled() << alarm->hasTime() << alarm->time()
+                       << alarm->hasStartOffset() << alarm->startOffset().asSeconds()
+                       << alarm->hasEndOffset() << alarm->endOffset().asSeconds()
+                       << alarm->snoozeTime().asSeconds() << alarm->repeatCount() << alarm->text()
+                       << alarm->audioFile() << alarm->programFile() << alarm->programArguments()
+                       << alarm->mailSubject() << alarm->mailText() << alarm->mailAttachments();
+            }
+
+            Q_FOREACH (const KCalendarCore::Attachment &attachment, incidence->attachments()) {
+                stream << attachment.uri() << attachment.mimeType() << attachment.label()
+                       << attachment.decodedData();
+            }
+
+            return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+        }
+
         void prepareImportedIncidence(KCalendarCore::Incidence::Ptr incidence, bool printDebug)
         {
             if (incidence->type() != KCalendarCore::IncidenceBase::TypeEvent) {
@@ -449,97 +533,392 @@ namespace CalendarImportExport {
         storage->close();
     }
 
-    QString constructExportIcs(mKCal::ExtendedCalendar::Ptr calendar, KCalendarCore::Incidence::List incidencesToExport, bool printDebug)
+    void addExportIncidence(KCalendarCore::MemoryCalendar::Ptr memoryCalendar, mKCal::ExtendedCalendar::Ptr calendar, KCalendarCore::Incidence::Ptr toExport, bool printDebug)
     {
-        // create an in-memory calendar
-        // add to it the required incidences (ie, check if has recurrenceId -> load parent and all instances; etc)
+        // add to the in-memory calendar the required incidences (ie, check if has recurrenceId -> load parent and all instances; etc)
         // for each of those, we need to do the IncidenceToExport() modifications first
-        // then, export from that calendar to .ics file.
+        LOG_DEBUG("Exporting incidence:" << toExport->uid());
+        if (toExport->hasRecurrenceId() || toExport->recurs()) {
+            KCalendarCore::Incidence::Ptr recurringIncidence = toExport->hasRecurrenceId()
+                                                    ? calendar->incidence(toExport->uid(), QDateTime())
+                                                    : toExport;
+            // Don't crash on null instances
+            if (recurringIncidence.isNull()) return;
+            KCalendarCore::Incidence::List instances = calendar->instances(recurringIncidence);
+            KCalendarCore::Incidence::Ptr exportableIncidence = IncidenceHandler::incidenceToExport(recurringIncidence, printDebug);
+
+            // remove EXDATE values from the recurring incidence which correspond to the persistent occurrences (instances)
+            Q_FOREACH (KCalendarCore::Incidence::Ptr instance, instances) {
+                QList<QDateTime> exDateTimes = exportableIncidence->recurrence()->exDateTimes();
+                exDateTimes.removeAll(instance->recurrenceId());
+                exportableIncidence->recurrence()->setExDateTimes(exDateTimes);
+            }
+
+            // store the base recurring event into the in-memory calendar
+            memoryCalendar->addIncidence(exportableIncidence);
+
+            // now create the persistent occurrences in the in-memory calendar
+            Q_FOREACH (KCalendarCore::Incidence::Ptr instance, instances) {
+                // We cannot call dissociateSingleOccurrence() on the MemoryCalendar
+                // as that's an mKCal specific function.
+                // We cannot call dissociateOccurrence() because that function
+                // takes only a QDate instead of a QDateTime recurrenceId.
+                // Thus, we need to manually create an exception occurrence.
+                KCalendarCore::Incidence::Ptr exportableOccurrence(exportableIncidence->clone());
+                exportableOccurrence->setCreated(instance->created());
+                exportableOccurrence->setRevision(instance->revision());
+                exportableOccurrence->clearRecurrence();
+                exportableOccurrence->setRecurrenceId(instance->recurrenceId());
+                exportableOccurrence->setDtStart(instance->recurrenceId());
+
+                // add it, and then update it in-memory.
+                memoryCalendar->addIncidence(exportableOccurrence);
+                exportableOccurrence = memoryCalendar->incidence(instance->uid(), instance->recurrenceId());
+                exportableOccurrence->startUpdates();
+                IncidenceHandler::copyIncidenceProperties(exportableOccurrence, IncidenceHandler::incidenceToExport(instance, printDebug));
+                exportableOccurrence->endUpdates();
+            }
+        } else {
+            KCalendarCore::Incidence::Ptr exportableIncidence = IncidenceHandler::incidenceToExport(toExport, printDebug);
+            memoryCalendar->addIncidence(exportableIncidence);
+        }
+    }
+
+    bool writeAll(QIODevice *device, const QByteArray &data)
+    {
+        qint64 bytesWritten = 0;
+        while (bytesWritten < data.size()) {
+            qint64 count = device->write(data.constData() + bytesWritten, data.size() - bytesWritten);
+            if (count == -1) {
+                return false;
+            }
+            bytesWritten += count;
+        }
+        return true;
+    }
+
+    // Splits serialized calendar data into the calendar properties
+    // and its top level components.
+    void splitCalendar(const QByteArray &ics, QByteArray *properties, QList<QByteArray> *components)
+    {
+        QByteArray component;
+        int depth = 0;
+        int start = 0;
+        while (start < ics.size()) {
+            int end = ics.indexOf('\n', start);
+            end = end < 0 ? ics.size() : end + 1;
+            const QByteArray line = ics.mid(start, end - start);
+            start = end;
+
+            if (line.startsWith("BEGIN:") && ++depth == 1) {
+                continue; // BEGIN:VCALENDAR
+            }
+            if (depth == 1) {
+                if (line.startsWith("END:")) {
+                    --depth; // END:VCALENDAR
+                } else {
+                    properties->append(line);
+                }
+                continue;
+            }
+            component += line;
+            if (line.startsWith("END:") && --depth == 1) {
+                components->append(component);
+                component.clear();
+            }
+        }
+    }
+
+    QByteArray timeZoneId(const QByteArray &component)
+    {
+        const int start = component.indexOf("\nTZID:");
+        if (start < 0) {
+            return QByteArray();
+        }
+        const int end = component.indexOf('\n', start + 1);
+        return component.mid(start + 6, end - start - 6).trimmed();
+    }
+
+    // Copies the incidences of one series into an in-memory calendar.
+    // Reads the given calendar, which isn't safe to share between threads.
+    KCalendarCore::MemoryCalendar::Ptr exportSeries(mKCal::ExtendedCalendar::Ptr calendar,
+                                                    const KCalendarCore::Incidence::List &incidencesToExport,
+                                                    const KCalendarCore::Incidence::List &deletedIncidences,
+                                                    bool printDebug)
+    {
         KCalendarCore::MemoryCalendar::Ptr memoryCalendar(new KCalendarCore::MemoryCalendar(QTimeZone::utc()));
         Q_FOREACH (KCalendarCore::Incidence::Ptr toExport, incidencesToExport) {
-          LOG_DEBUG("Exporting incidence:" << toExport->uid());
-            if (toExport->hasRecurrenceId() || toExport->recurs()) {
-                KCalendarCore::Incidence::Ptr recurringIncidence = toExport->hasRecurrenceId()
-                                                        ? calendar->incidence(toExport->uid(), QDateTime())
-                                                        : toExport;
-                // Don't crash on null instances
-                if (recurringIncidence.isNull()) continue;
-                KCalendarCore::Incidence::List instances = calendar->instances(recurringIncidence);
-                KCalendarCore::Incidence::Ptr exportableIncidence = IncidenceHandler::incidenceToExport(recurringIncidence, printDebug);
-
-                // remove EXDATE values from the recurring incidence which correspond to the persistent occurrences (instances)
-                Q_FOREACH (KCalendarCore::Incidence::Ptr instance, instances) {
-                    QList<QDateTime> exDateTimes = exportableIncidence->recurrence()->exDateTimes();
-                    exDateTimes.removeAll(instance->recurrenceId());
-                    exportableIncidence->recurrence()->setExDateTimes(exDateTimes);
-                }
-
-                // store the base recurring event into the in-memory calendar
-                memoryCalendar->addIncidence(exportableIncidence);
-
-                // now create the persistent occurrences in the in-memory calendar
-                Q_FOREACH (KCalendarCore::Incidence::Ptr instance, instances) {
-                    // We cannot call dissociateSingleOccurrence() on the MemoryCalendar
-                    // as that's an mKCal specific function.
-                    // We cannot call dissociateOccurrence() because that function
-                    // takes only a QDate instead of a QDateTime recurrenceId.
-                    // Thus, we need to manually create an exception occurrence.
-                    KCalendarCore::Incidence::Ptr exportableOccurrence(exportableIncidence->clone());
-                    exportableOccurrence->setCreated(instance->created());
-                    exportableOccurrence->setRevision(instance->revision());
-                    exportableOccurrence->clearRecurrence();
-                    exportableOccurrence->setRecurrenceId(instance->recurrenceId());
-                    exportableOccurrence->setDtStart(instance->recurrenceId());
-
-                    // add it, and then update it in-memory.
-                    memoryCalendar->addIncidence(exportableOccurrence);
-                    exportableOccurrence = memoryCalendar->incidence(instance->uid(), instance->recurrenceId());
-                    exportableOccurrence->startUpdates();
-                    IncidenceHandler::copyIncidenceProperties(exportableOccurrence, IncidenceHandler::incidenceToExport(instance, printDebug));
-                    exportableOccurrence->endUpdates();
-                }
-            } else {
-                KCalendarCore::Incidence::Ptr exportableIncidence = IncidenceHandler::incidenceToExport(toExport, printDebug);
-                memoryCalendar->addIncidence(exportableIncidence);
+            addExportIncidence(memoryCalendar, calendar, toExport, printDebug);
+        }
+        Q_FOREACH (KCalendarCore::Incidence::Ptr deleted, deletedIncidences) {
+            // deletions are exported as cancelled incidences, which the import removes.
+            if (memoryCalendar->incidence(deleted->uid(), deleted->recurrenceId())) {
+                continue; // re-created since.
             }
+            KCalendarCore::Incidence::Ptr exportableIncidence(deleted->clone());
+            exportableIncidence->setStatus(KCalendarCore::Incidence::StatusCanceled);
+            exportableIncidence->setNonKDECustomProperty(DeletedProperty, QStringLiteral("TRUE"));
+            memoryCalendar->addIncidence(exportableIncidence);
         }
+        return memoryCalendar;
+    }
 
+    // Only touches its own copy, so that several series can be
+    // serialized concurrently.
+    QByteArray serializeSeries(const KCalendarCore::MemoryCalendar::Ptr &memoryCalendar)
+    {
         KCalendarCore::ICalFormat icalFormat;
-        return icalFormat.toString(memoryCalendar, QString(), false);
+        return icalFormat.toString(memoryCalendar, QString(), false).toUtf8();
+    }
+
+    bool writeExportIcs(QIODevice *device, mKCal::ExtendedCalendar::Ptr calendar,
+                        const KCalendarCore::Incidence::List &incidencesToExport,
+                        const KCalendarCore::Incidence::List &deletedIncidences, bool printDebug)
+    {
+        // group the incidences by series, each series is then copied,
+        // serialized and written on its own. The copies are made here,
+        // a batch at a time, and only their serialization runs concurrently,
+        // so that at most a batch of series is in memory at once.
+        QStringList uids;
+        QHash<QString, KCalendarCore::Incidence::List> series;
+        QHash<QString, KCalendarCore::Incidence::List> deletedSeries;
+        Q_FOREACH (KCalendarCore::Incidence::Ptr toExport, incidencesToExport) {
+            if (!series.contains(toExport->uid())) {
+                uids.append(toExport->uid());
+            }
+            series[toExport->uid()].append(toExport);
+        }
+        Q_FOREACH (KCalendarCore::Incidence::Ptr deleted, deletedIncidences) {
+            if (!series.contains(deleted->uid()) && !deletedSeries.contains(deleted->uid())) {
+                uids.append(deleted->uid());
+            }
+            deletedSeries[deleted->uid()].append(deleted);
+        }
+
+        const int batchSize = qMax(1, QThread::idealThreadCount());
+        bool headerWritten = false;
+        QSet<QByteArray> writtenTimeZones;
+        for (int first = 0; first < uids.count(); first += batchSize) {
+            QList<KCalendarCore::MemoryCalendar::Ptr> batch;
+            Q_FOREACH (const QString &uid, uids.mid(first, batchSize)) {
+                batch << exportSeries(calendar, series.take(uid), deletedSeries.take(uid), printDebug);
+            }
+            const QList<QByteArray> serialized = QtConcurrent::blockingMapped<QList<QByteArray> >(batch, serializeSeries);
+            batch.clear();
+
+            Q_FOREACH (const QByteArray &ics, serialized) {
+                QByteArray properties;
+                QList<QByteArray> components;
+                splitCalendar(ics, &properties, &components);
+                if (!headerWritten) {
+                    if (!writeAll(device, QByteArrayLiteral("BEGIN:VCALENDAR\r\n") + properties)) {
+                        return false;
+                    }
+                    headerWritten = true;
+                }
+                Q_FOREACH (const QByteArray &component, components) {
+                    if (component.startsWith("BEGIN:VTIMEZONE")) {
+                        const QByteArray tzid = timeZoneId(component);
+                        if (writtenTimeZones.contains(tzid)) {
+                            continue;
+                        }
+                        writtenTimeZones.insert(tzid);
+                    }
+                    if (!writeAll(device, component)) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        if (!headerWritten) {
+            // nothing changed, still write a calendar for the delta to apply.
+            KCalendarCore::MemoryCalendar::Ptr emptyCalendar(new KCalendarCore::MemoryCalendar(QTimeZone::utc()));
+            return writeAll(device, serializeSeries(emptyCalendar));
+        }
+        return writeAll(device, QByteArrayLiteral("END:VCALENDAR\r\n"));
+    }
+
+    QString manifestFileName(const QString &backupFile)
+    {
+        return backupFile + QStringLiteral(".manifest");
+    }
+
+    // Returns the cut-off of a delta backup, or an invalid date time
+    // for a full one.
+    QDateTime backupSince(const QString &backupFile)
+    {
+        if (!QFile::exists(manifestFileName(backupFile))) {
+            return QDateTime();
+        }
+        QSettings manifest(manifestFileName(backupFile), QSettings::IniFormat);
+        return QDateTime::fromString(manifest.value(QStringLiteral("export/since")).toString(), Qt::ISODate);
+    }
+
+    // Returns the notebook a backup was exported from, or an empty
+    // string without a manifest.
+    QString backupNotebook(const QString &backupFile)
+    {
+        if (!QFile::exists(manifestFileName(backupFile))) {
+            return QString();
+        }
+        QSettings manifest(manifestFileName(backupFile), QSettings::IniFormat);
+        return manifest.value(QStringLiteral("export/notebook")).toString();
+    }
+
+    struct NotebookExport {
+        QString fileName;
+        QString notebookUid;
+        QDateTime since;
+        QDateTime until;
+        bool printDebug;
+    };
+
+    // Loads, writes and drops one notebook, so that only one is
+    // in memory at a time.
+    qint64 writeNotebookExport(mKCal::ExtendedStorage::Ptr storage, mKCal::ExtendedCalendar::Ptr calendar,
+                               const NotebookExport &notebookExport)
+    {
+        // if since is valid, only the changes made after it are exported.
+        const bool printDebug = notebookExport.printDebug;
+        const QString &notebookUid = notebookExport.notebookUid;
+        const QString &fileName = notebookExport.fileName;
+        LOG_DEBUG("Exporting notebook:" << notebookUid << "since:" << notebookExport.since.toString(Qt::ISODate));
+        KCalendarCore::Incidence::List incidences;
+        KCalendarCore::Incidence::List deleted;
+        if (notebookExport.since.isValid()) {
+            // only load the series which have changed.
+            KCalendarCore::Incidence::List changed;
+            storage->insertedIncidences(&changed, notebookExport.since, notebookUid);
+            storage->modifiedIncidences(&changed, notebookExport.since, notebookUid);
+            storage->deletedIncidences(&deleted, notebookExport.since, notebookUid);
+            QSet<QString> loadedUids;
+            Q_FOREACH (KCalendarCore::Incidence::Ptr incidence, changed) {
+                if (!loadedUids.contains(incidence->uid())) {
+                    loadedUids.insert(incidence->uid());
+                    storage->loadSeries(incidence->uid());
+                }
+                KCalendarCore::Incidence::Ptr loaded = calendar->incidence(incidence->uid(), incidence->recurrenceId());
+                if (loaded && !incidences.contains(loaded)) {
+                    incidences.append(loaded);
+                }
+            }
+        } else {
+            storage->loadNotebookIncidences(notebookUid);
+            storage->allIncidences(&incidences, notebookUid);
+        }
+        LOG_DEBUG("Found" << incidences.length() << "incidences and" << deleted.length() << "deletions to export.");
+
+        // a delta without changes is still written, so that its manifest
+        // records the new cut-off and replaces the previous delta.
+        if (!notebookExport.since.isValid() && incidences.isEmpty()) {
+            qWarning() << "No data to export from notebook:" << notebookUid;
+            calendar->close();
+            return 0;
+        }
+
+        QFile exportFile(fileName);
+        if (!exportFile.open(QIODevice::WriteOnly)) {
+            qWarning() << "Unable to open:" << fileName << "for export.";
+            calendar->close();
+            return -1;
+        }
+        const bool success = writeExportIcs(&exportFile, calendar, incidences, deleted, printDebug);
+        const int incidenceCount = incidences.count();
+        const int deletedCount = deleted.count();
+        incidences.clear();
+        deleted.clear();
+        calendar->close();
+        if (!success) {
+            qWarning() << "Error while writing export data to:" << fileName;
+            return -1;
+        }
+
+        // record the cut-off, the next delta backup starts from until.
+        QFile::remove(manifestFileName(fileName));
+        QSettings manifest(manifestFileName(fileName), QSettings::IniFormat);
+        manifest.setValue(QStringLiteral("export/notebook"), notebookUid);
+        if (notebookExport.since.isValid()) {
+            manifest.setValue(QStringLiteral("export/since"), notebookExport.since.toUTC().toString(Qt::ISODate));
+        }
+        manifest.setValue(QStringLiteral("export/until"), notebookExport.until.toString(Qt::ISODate));
+        manifest.setValue(QStringLiteral("export/incidences"), incidenceCount);
+        manifest.setValue(QStringLiteral("export/deleted"), deletedCount);
+        manifest.sync();
+        if (manifest.status() != QSettings::NoError) {
+            qWarning() << "Unable to write manifest:" << manifest.fileName();
+            return -1;
+        }
+
+        qDebug() << "Successfully wrote:" << exportFile.size() << "bytes of export data to:" << fileName;
+        return exportFile.size();
     }
 
-    QString constructExportIcs(const QString &notebookUid, const QString &incidenceUid, const QDateTime &recurrenceId, bool printDebug)
+    bool exportIcs(const QString &backup, const QStringList &notebookUids, bool allNotebooks, const QDateTime &since, bool printDebug)
     {
-        // if notebookUid empty, we fall back to the default notebook.
-        // if incidenceUid is empty, we load all incidences from the notebook.
+        // with a single notebook, backup is the file to write. Otherwise
+        // it's a directory, receiving one file per notebook.
+        // if no notebook is given, we fall back to the default notebook.
+        const QDateTime until = QDateTime::currentDateTimeUtc();
         mKCal::ExtendedCalendar::Ptr calendar = mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(QTimeZone::utc()));
         mKCal::ExtendedStorage::Ptr storage = mKCal::ExtendedCalendar::defaultStorage(calendar);
         storage->open();
-        storage->load();
-        mKCal::Notebook::Ptr notebook = notebookUid.isEmpty() ? defaultLocalCalendarNotebook(storage) : storage->notebook(notebookUid);
-        if (!notebook) {
-            qWarning() << "No default notebook exists or invalid notebook uid specified:" << notebookUid;
+
+        mKCal::Notebook::List notebooks;
+        if (allNotebooks) {
+            notebooks = storage->notebooks();
+        } else if (notebookUids.isEmpty()) {
+            notebooks << defaultLocalCalendarNotebook(storage);
+        } else {
+            Q_FOREACH (const QString &notebookUid, notebookUids) {
+                mKCal::Notebook::Ptr notebook = storage->notebook(notebookUid);
+                if (!notebooks.contains(notebook) || !notebook) {
+                    notebooks << notebook;
+                }
+            }
+        }
+        if (notebooks.isEmpty() || notebooks.contains(mKCal::Notebook::Ptr())) {
+            qWarning() << "No default notebook exists or invalid notebook uid specified:" << notebookUids;
             storage->close();
-            return QString();
+            return false;
         }
-        LOG_DEBUG("Exporting notebook:" << notebook->uid());
 
-        KCalendarCore::Incidence::List incidencesToExport;
-        if (incidenceUid.isEmpty()) {
-            storage->loadNotebookIncidences(notebook->uid());
-            storage->allIncidences(&incidencesToExport, notebook->uid());
-        } else {
-            storage->load(incidenceUid);
-            incidencesToExport << calendar->incidence(incidenceUid, recurrenceId);
+        const bool singleFile = !allNotebooks && notebooks.count() == 1;
+        if (!singleFile && !QDir().mkpath(backup)) {
+            qWarning() << "Unable to create export directory:" << backup;
+            storage->close();
+            return false;
+        }
+
+        // storage and calendar access is sequential, each notebook is
+        // loaded once and dropped before the next one.
+        bool success = true;
+        Q_FOREACH (const mKCal::Notebook::Ptr &notebook, notebooks) {
+            NotebookExport notebookExport;
+            notebookExport.fileName = singleFile ? backup : QDir(backup).filePath(notebook->uid() + QStringLiteral(".ics"));
+            notebookExport.notebookUid = notebook->uid();
+            notebookExport.since = since;
+            notebookExport.until = until;
+            notebookExport.printDebug = printDebug;
+            if (writeNotebookExport(storage, calendar, notebookExport) < 0) {
+                success = false;
+            }
         }
-        LOG_DEBUG("Found" << incidencesToExport.length() << "incidences to export.");
 
-        QString retn = constructExportIcs(calendar, incidencesToExport, printDebug);
         storage->close();
-        return retn;
+        return success;
     }
 
-    bool updateIncidence(mKCal::ExtendedCalendar::Ptr calendar, mKCal::Notebook::Ptr notebook, KCalendarCore::Incidence::Ptr incidence, bool *criticalError, bool printDebug)
+    struct ImportStatistics {
+        ImportStatistics() : added(0), updated(0), skipped(0), deleted(0) {}
+
+        int added;
+        int updated;
+        int skipped;
+        int deleted;
+    };
+
+    bool updateIncidence(mKCal::ExtendedCalendar::Ptr calendar, mKCal::Notebook::Ptr notebook, KCalendarCore::Incidence::Ptr incidence, ImportStatistics *statistics, bool *criticalError, bool printDebug)
     {
         if (incidence.isNull()) {
             return false;
@@ -569,26 +948,39 @@ namespace CalendarImportExport {
                     qWarning() << "Error removing cancelled occurrence:" << storedIncidence->uid() << storedIncidence->recurrenceId().toString();
                     return false;
                 }
+                statistics->deleted++;
             } else {
-                LOG_DEBUG("Updating existing event:" << storedIncidence->uid() << storedIncidence->recurrenceId().toString());
-                storedIncidence->startUpdates();
                 IncidenceHandler::prepareImportedIncidence(incidence, printDebug);
-                IncidenceHandler::copyIncidenceProperties(storedIncidence, incidence);
 
                 // if this incidence is a recurring incidence, we should get all persistent occurrences
                 // and add them back as EXDATEs.  This is because mkcal expects that dissociated
                 // single instances will correspond to an EXDATE, but most sync servers do not (and
                 // so will not include the RECURRENCE-ID values as EXDATEs of the parent).
-                if (storedIncidence->recurs()) {
+                // Do it on a copy first, to compare with the stored incidence.
+                KCalendarCore::Incidence::Ptr updated(incidence->clone());
+                if (updated->recurs()) {
                     KCalendarCore::Incidence::List instances = calendar->instances(incidence);
                     Q_FOREACH (KCalendarCore::Incidence::Ptr instance, instances) {
                         if (instance->hasRecurrenceId()) {
-                            storedIncidence->recurrence()->addExDateTime(instance->recurrenceId());
+                            updated->recurrence()->addExDateTime(instance->recurrenceId());
                         }
                     }
                 }
+
+                if (IncidenceHandler::contentHash(storedIncidence) == IncidenceHandler::contentHash(updated)) {
+                    LOG_DEBUG("Skipping unchanged event:" << storedIncidence->uid() << storedIncidence->recurrenceId().toString());
+                    statistics->skipped++;
+                    return true;
+                }
+
+                LOG_DEBUG("Updating existing event:" << storedIncidence->uid() << storedIncidence->recurrenceId().toString());
+                storedIncidence->startUpdates();
+                IncidenceHandler::copyIncidenceProperties(storedIncidence, updated);
                 storedIncidence->endUpdates();
+                statistics->updated++;
             }
+        } else if (!incidence->nonKDECustomProperty(DeletedProperty).isEmpty()) {
+            LOG_DEBUG("Ignoring deletion of unknown incidence:" << incidence->uid() << incidence->recurrenceId().toString());
         } else {
             // the new incidence will be either a new persistent occurrence, or a new base-series (or new non-recurring).
             LOG_DEBUG("Have new incidence:" << incidence->uid() << incidence->recurrenceId().toString());
@@ -614,6 +1006,7 @@ namespace CalendarImportExport {
                     return false;
                 }
                 LOG_DEBUG("Added new occurrence incidence:" << occurrence->uid() << occurrence->recurrenceId().toString());
+                statistics->added++;
             } else {
                 // just a new event without needing detach.
                 IncidenceHandler::prepareImportedIncidence(incidence, printDebug);
@@ -635,6 +1028,7 @@ namespace CalendarImportExport {
                 }
                 if (added) {
                     LOG_DEBUG("Added new incidence:" << incidence->uid() << incidence->recurrenceId().toString());
+                    statistics->added++;
                 } else {
                     qWarning() << "Unable to add incidence" << incidence->uid() << incidence->recurrenceId().toString() << "to notebook" << notebook->uid();
                     *criticalError = true;
@@ -645,22 +1039,46 @@ namespace CalendarImportExport {
         return true;
     }
 
-    bool importIcsData(const QString &icsData, const QString &notebookUid, bool destructiveImport, bool printDebug)
+    bool parseImportData(const QByteArray &data, KCalendarCore::Incidence::List *incidences)
     {
         KCalendarCore::ICalFormat iCalFormat;
         KCalendarCore::MemoryCalendar::Ptr cal(new KCalendarCore::MemoryCalendar(QTimeZone::utc()));
-        if (!iCalFormat.fromString(cal, icsData)) {
+        if (!iCalFormat.fromRawString(cal, data)) {
             qWarning() << "unable to parse iCal data, trying as vCal";
             KCalendarCore::VCalFormat vCalFormat;
-            if (!vCalFormat.fromString(cal, icsData)) {
+            if (!vCalFormat.fromRawString(cal, data)) {
                 qWarning() << "unable to parse vCal data";
                 return false;
             }
         }
+        *incidences = cal->incidences();
+        return true;
+    }
+
+    struct ParsedFile {
+        QString fileName;
+        bool ok;
+        KCalendarCore::Incidence::List incidences;
+    };
+
+    ParsedFile parseImportFile(const QString &fileName)
+    {
+        ParsedFile parsed;
+        parsed.fileName = fileName;
+        parsed.ok = false;
+        QFile importFile(fileName);
+        if (!importFile.open(QIODevice::ReadOnly)) {
+            qWarning() << "Unable to open:" << fileName << "for import.";
+            return parsed;
+        }
+        parsed.ok = parseImportData(importFile.readAll(), &parsed.incidences);
+        return parsed;
+    }
 
+    bool importIncidences(const KCalendarCore::Incidence::List &importedIncidences, const QString &notebookUid, bool destructiveImport, bool printDebug)
+    {
         // Reorganize the list of imported incidences into lists of incidences segregated by UID.
         QHash<QString, KCalendarCore::Incidence::List> uidIncidences;
-        KCalendarCore::Incidence::List importedIncidences = cal->incidences();
         Q_FOREACH (KCalendarCore::Incidence::Ptr imported, importedIncidences) {
             IncidenceHandler::prepareImportedIncidence(imported, printDebug);
             uidIncidences[imported->uid()] << imported;
@@ -673,17 +1091,18 @@ namespace CalendarImportExport {
         mKCal::ExtendedCalendar::Ptr calendar = mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(QTimeZone::utc()));
         mKCal::ExtendedStorage::Ptr storage = mKCal::ExtendedCalendar::defaultStorage(calendar);
         storage->open();
-        storage->load();
         mKCal::Notebook::Ptr notebook = notebookUid.isEmpty() ? defaultLocalCalendarNotebook(storage) : storage->notebook(notebookUid);
         if (!notebook) {
             qWarning() << "No default notebook exists or invalid notebook uid specified:" << notebookUid;
             storage->close();
             return false;
         }
+        // Only the notebook being imported into is needed for comparison.
         KCalendarCore::Incidence::List notebookIncidences;
         storage->loadNotebookIncidences(notebook->uid());
         storage->allIncidences(&notebookIncidences, notebook->uid());
 
+        ImportStatistics statistics;
         if (destructiveImport) {
             // Any incidences which don't exist in the import list should be deleted.
             Q_FOREACH (KCalendarCore::Incidence::Ptr possiblyDoomed, notebookIncidences) {
@@ -695,6 +1114,7 @@ namespace CalendarImportExport {
                         storage->close();
                         return false;
                     }
+                    statistics.deleted++;
                 } // no need to remove rolled-back persistent occurrences here; we do that later.
             }
         }
@@ -717,7 +1137,7 @@ namespace CalendarImportExport {
                 LOG_DEBUG("No parent or base incidence in incidence list, performing direct updates to persistent occurrences");
                 for (int i = 0; i < incidences.size(); ++i) {
                     KCalendarCore::Incidence::Ptr importInstance = incidences[i];
-                    updateIncidence(calendar, notebook, importInstance, &criticalError, printDebug);
+                    updateIncidence(calendar, notebook, importInstance, &statistics, &criticalError, printDebug);
                     if (criticalError) {
                         qWarning() << "Error saving updated persistent occurrence:" << importInstance->uid() << importInstance->recurrenceId().toString();
                         storage->close();
@@ -736,7 +1156,7 @@ namespace CalendarImportExport {
                 // first save the added/updated base incidence
                 LOG_DEBUG("Saving the added/updated base incidence before saving persistent exceptions:" << incidences[parentIndex]->uid());
                 KCalendarCore::Incidence::Ptr updatedBaseIncidence = incidences[parentIndex];
-                updateIncidence(calendar, notebook, updatedBaseIncidence, &criticalError, printDebug); // update the base incidence first.
+                updateIncidence(calendar, notebook, updatedBaseIncidence, &statistics, &criticalError, printDebug); // update the base incidence first.
                 if (criticalError) {
                     qWarning() << "Error saving base incidence:" << updatedBaseIncidence->uid();
                     storage->close();
@@ -753,7 +1173,7 @@ namespace CalendarImportExport {
                     LOG_DEBUG("Now saving a persistent exception:" << incidences[i]->recurrenceId().toString());
                     KCalendarCore::Incidence::Ptr importInstance = incidences[i];
                     importRecurrenceIds.append(importInstance->recurrenceId());
-                    updateIncidence(calendar, notebook, importInstance, &criticalError, printDebug);
+                    updateIncidence(calendar, notebook, importInstance, &statistics, &criticalError, printDebug);
                     if (criticalError) {
                         qWarning() << "Error saving updated persistent occurrence:" << importInstance->uid() << importInstance->recurrenceId().toString();
                         storage->close();
@@ -772,16 +1192,95 @@ namespace CalendarImportExport {
                                 storage->close();
                                 return false;
                             }
+                            statistics.deleted++;
                         }
                     }
                 }
             }
         }
 
-        storage->save();
+        qDebug() << "Import summary for notebook" << notebook->uid() << "- added:" << statistics.added
+                 << "updated:" << statistics.updated << "skipped:" << statistics.skipped
+                 << "deleted:" << statistics.deleted;
+        if (statistics.added || statistics.updated || statistics.deleted) {
+            storage->save();
+        }
         storage->close();
         return true;
     }
+
+    bool sinceLessThan(const QPair<QDateTime, QString> &a, const QPair<QDateTime, QString> &b)
+    {
+        // full backups (invalid since) come first.
+        if (a.first.isValid() != b.first.isValid()) {
+            return !a.first.isValid();
+        }
+        return a.first < b.first;
+    }
+
+    bool importFiles(const QStringList &backupFiles, const QString &notebookUid, bool destructiveImport, bool printDebug)
+    {
+        // Delta backups are applied on top of the full backup, oldest first.
+        QList<QPair<QDateTime, QString> > backups;
+        Q_FOREACH (const QString &backupFile, backupFiles) {
+            backups.append(qMakePair(backupSince(backupFile), backupFile));
+        }
+        std::stable_sort(backups.begin(), backups.end(), sinceLessThan);
+        QStringList fileNames;
+        for (int i = 0; i < backups.count(); ++i) {
+            if (backups[i].first.isValid() && destructiveImport) {
+                qWarning() << "Cannot do a destructive import of delta backup:" << backups[i].second;
+                return false;
+            }
+            fileNames.append(backups[i].second);
+        }
+
+        // Parsing is independent per file, spread it over the cores.
+        const QList<ParsedFile> parsedFiles = QtConcurrent::blockingMapped<QList<ParsedFile> >(fileNames, parseImportFile);
+
+        // Merge the files into one batch per notebook, the one they were
+        // exported from, or the given one for files without a manifest.
+        // When the same incidence is found in several files of a batch,
+        // the one found last wins.
+        QStringList notebookUids;
+        QHash<QString, KCalendarCore::Incidence::List> importedIncidences;
+        QHash<QString, QHash<QPair<QString, QDateTime>, int> > incidenceIndexes;
+        Q_FOREACH (const ParsedFile &parsed, parsedFiles) {
+            if (!parsed.ok) {
+                qWarning() << "Failed to parse:" << parsed.fileName;
+                return false;
+            }
+            QString fileNotebookUid = backupNotebook(parsed.fileName);
+            if (fileNotebookUid.isEmpty()) {
+                fileNotebookUid = notebookUid;
+            }
+            if (!notebookUids.contains(fileNotebookUid)) {
+                notebookUids.append(fileNotebookUid);
+            }
+            LOG_DEBUG("Parsed" << parsed.incidences.count() << "incidences from" << parsed.fileName
+                      << "for notebook:" << fileNotebookUid);
+            KCalendarCore::Incidence::List &incidences = importedIncidences[fileNotebookUid];
+            QHash<QPair<QString, QDateTime>, int> &indexes = incidenceIndexes[fileNotebookUid];
+            Q_FOREACH (const KCalendarCore::Incidence::Ptr &incidence, parsed.incidences) {
+                const QPair<QString, QDateTime> key(incidence->uid(), incidence->recurrenceId());
+                QHash<QPair<QString, QDateTime>, int>::const_iterator it = indexes.constFind(key);
+                if (it != indexes.constEnd()) {
+                    incidences[it.value()] = incidence;
+                } else {
+                    indexes.insert(key, incidences.count());
+                    incidences.append(incidence);
+                }
+            }
+        }
+
+        Q_FOREACH (const QString &batchNotebookUid, notebookUids) {
+            if (!importIncidences(importedIncidences.value(batchNotebookUid), batchNotebookUid,
+                                  destructiveImport, printDebug)) {
+                return false;
+            }
+        }
+        return true;
+    }
 }
 
 
@@ -803,16 +1302,22 @@ int main(int argc, char *argv[])
         ? QString() : parser.positionalArguments().first();
     if (command == "import") {
         parser.clearPositionalArguments();
-        parser.addPositionalArgument("import", "import the ICS data found in backup.ics.");
-        parser.addPositionalArgument("backup", "file to be read.", "backup.ics");
+        parser.addPositionalArgument("import", "import the ICS data found in the given files and directories. Delta backups are applied in order on top of full ones.");
+        parser.addPositionalArgument("backup", "files or directories of .ics and .vcs files to be read.", "backup.ics [backup2.ics|directory ...]");
         parser.addOption(QCommandLineOption(QStringList() << "d" << "destructive",
                                             "local calendar data will be removed prior to import."));
+        parser.addOption(QCommandLineOption(QStringList() << "n" << "notebook",
+                                            "uid of notebook to import the files without a manifest into.", "uid"));
     } else if (command == "export") {
         parser.clearPositionalArguments();
-        parser.addPositionalArgument("export", "export calendar entries as ICS data in backup.ics.");
-        parser.addPositionalArgument("backup", "file to be written.", "backup.ics");
+        parser.addPositionalArgument("export", "export calendar entries as ICS data in backup.ics, and the export details in backup.ics.manifest.");
+        parser.addPositionalArgument("backup", "file to be written, or directory to write one file per notebook to when exporting several notebooks.", "backup.ics");
         parser.addOption(QCommandLineOption(QStringList() << "n" << "notebook",
-                                            "uid of notebook to export.", "uid"));
+                                            "uid of notebook to export, can be given several times.", "uid"));
+        parser.addOption(QCommandLineOption(QStringList() << "a" << "all-notebooks",
+                                            "export all notebooks."));
+        parser.addOption(QCommandLineOption(QStringList() << "s" << "since",
+                                            "only export the changes made after the given ISO 8601 date time.", "timestamp"));
     } else if (command == "list") {
         parser.clearPositionalArguments();
         parser.addPositionalArgument("list", "list all notebooks known on device.");
@@ -829,50 +1334,45 @@ int main(int argc, char *argv[])
         qputenv("KCALDEBUG", "1");
     }
     if (command == QStringLiteral("import")) {
-        if (parser.positionalArguments().length() != 2)
+        if (parser.positionalArguments().length() < 2)
             parser.showHelp();
-        const QString backupFile = parser.positionalArguments().at(1);
-        if (!QFile::exists(backupFile)) {
-            qWarning() << "no such file exists:" << backupFile << "; cannot import.";
-        } else {
-            QFile importFile(backupFile);
-            if (importFile.open(QIODevice::ReadOnly)) {
-                QString fileData = QString::fromUtf8(importFile.readAll());
-                if (CalendarImportExport::importIcsData(fileData, QString(), parser.isSet("destructive"), verbose)) {
-                    qDebug() << "Successfully imported:" << backupFile;
-                    return 0;
-                }
-                qWarning() << "Failed to import:" << backupFile;
+        QStringList backupFiles;
+        bool missingFiles = false;
+        Q_FOREACH (const QString &backup, parser.positionalArguments().mid(1)) {
+            const QFileInfo info(backup);
+            if (info.isDir()) {
+                Q_FOREACH (const QFileInfo &entry, QDir(backup).entryInfoList(QStringList() << "*.ics" << "*.vcs",
+                                                                                QDir::Files, QDir::Name)) {
+                    backupFiles << entry.filePath();
+                }
+            } else if (info.exists()) {
+                backupFiles << backup;
             } else {
-                qWarning() << "Unable to open:" << backupFile << "for import.";
+                qWarning() << "no such file exists:" << backup << "; cannot import.";
+                missingFiles = true;
             }
         }
+        if (!missingFiles) {
+            if (CalendarImportExport::importFiles(backupFiles, parser.value("notebook"), parser.isSet("destructive"), verbose)) {
+                qDebug() << "Successfully imported:" << backupFiles;
+                return 0;
+            }
+            qWarning() << "Failed to import:" << backupFiles;
+        }
     } else if (command == QStringLiteral("export")) {
         if (parser.positionalArguments().length() != 2)
             parser.showHelp();
         const QString backupFile = parser.positionalArguments().at(1);
-        QString exportIcsData = CalendarImportExport::constructExportIcs(parser.value("notebook"), QString(), QDateTime(), verbose);
-        if (exportIcsData.isEmpty()) {
-            qWarning() << "No data to export!";
-            return 0;
-        }
-        QFile exportFile(backupFile);
-        if (exportFile.open(QIODevice::WriteOnly)) {
-            QByteArray ba = exportIcsData.toUtf8();
-            qint64 bytesRemaining = ba.size();
-            while (bytesRemaining) {
-                qint64 count = exportFile.write(ba, bytesRemaining);
-                if (count == -1) {
-                    qWarning() << "Error while writing export data to:" << backupFile;
-                    return 1;
-                } else {
-                    bytesRemaining -= count;
-                }
+        QDateTime since;
+        if (parser.isSet("since")) {
+            since = QDateTime::fromString(parser.value("since"), Qt::ISODate);
+            if (!since.isValid()) {
+                qWarning() << "Invalid timestamp:" << parser.value("since");
+                return 1;
             }
-            qDebug() << "Successfully wrote:" << ba.size() << "bytes of export data to:" << backupFile;
+        }
+        if (CalendarImportExport::exportIcs(backupFile, parser.values("notebook"), parser.isSet("all-notebooks"), since, verbose)) {
             return 0;
-        } else {
-            qWarning() << "Unable to open:" << backupFile << "for export.";
         }
     } else if (command == QStringLiteral("list")) {
         CalendarImportExport::listNotebooks();